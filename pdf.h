@@ -2,9 +2,19 @@
 #define PDF_H
 
 #include "pdfbase.h"
+#include "pdfinput.h"
 #include "pdffile.h"
 #include "pdfparser.h"
 #include "pdffilter.h"
 #include "pdfobjstream.h"
+#include "pdfdocument.h"
+#include "pdfpool.h"
+#include "pdfsplit.h"
+#include "pdfoutput.h"
+#include "pdfpush.h"
+#include "pdfrecover.h"
+#include "pdfcache.h"
+#include "pdfstats.h"
+#include "pdfresolve.h"
 
 #endif
@@ -1,40 +1,493 @@
 #include <iostream>
 #include <fstream>
-#include <utility>
 #include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <utility>
 #include <vector>
-#include <tuple>
+#include <memory_resource>
 #include <cstdio>
+#include <getopt.h>
 
 #include "pdf.h"
 
+using Entry = pdf::Document::Entry;
+
+// Keeps the newest generation of each object, and of those the last one written.
+void set_entry(std::vector<Entry>& xref, unsigned long num, Entry entry) {
+  if(num >= xref.size())
+    xref.resize(num + 1, {Entry::Type::none, 0, 0});
+  auto gen = [](const Entry& e) { return e.type == Entry::Type::compressed ? 0 : e.gen; };
+  if(xref[num].type == Entry::Type::none || gen(entry) >= gen(xref[num]))
+    xref[num] = entry;
+}
+
+/* Collects small objects into object streams. Each is finished after
+   maxObjects objects, but numbered only in the end, when it's known which
+   object numbers are free. */
+class ObjStmPacker {
+  public:
+  struct Packed {
+    std::vector<unsigned long> nums;
+    pdf::Stream stream;
+  };
+
+  private:
+  static constexpr std::size_t maxObjects = 100;
+
+  std::vector<unsigned long> _nums;
+  pdf::Writer _header, _body;
+  std::vector<Packed> _packed;
+
+  public:
+  // Whether the object may be stored in an object stream.
+  static bool accepts(const pdf::NamedObject& nmo) {
+    return nmo.numgen().second == 0 && !nmo.object().is<pdf::Stream>() && !nmo.failed();
+  }
+
+  void add(const pdf::NamedObject& nmo) {
+    unsigned long num = nmo.numgen().first;
+    _header.put(num);
+    _header.put(' ');
+    _header.put(static_cast<unsigned long>(_body.size()));
+    _header.put(' ');
+    nmo.object().dump(_body, 0);
+    _body.put('\n');
+    _nums.push_back(num);
+    if(_nums.size() == maxObjects)
+      finish();
+  }
+
+  std::vector<Packed>& packed() {
+    finish();
+    return _packed;
+  }
+
+  private:
+  void finish() {
+    if(_nums.empty())
+      return;
+    _header.put('\n');
+    std::string data{_header.data()};
+    data.append(_body.data());
+    std::string compressed = pdf::codec::deflate(data);
+    pdf::Dictionary::Items items{};
+    items.emplace_back(pdf::names::Type, pdf::Object{pdf::Name{pdf::names::ObjStm}});
+    items.emplace_back(pdf::names::N, pdf::Object{pdf::Numeric{static_cast<long>(_nums.size())}});
+    items.emplace_back(pdf::names::First, pdf::Object{pdf::Numeric{static_cast<long>(_header.size())}});
+    items.emplace_back(pdf::names::Filter, pdf::Object{pdf::Name{"FlateDecode"}});
+    items.emplace_back(pdf::names::Length, pdf::Object{pdf::Numeric{static_cast<long>(compressed.length())}});
+    _packed.push_back({std::move(_nums), pdf::Stream{pdf::Dictionary{std::move(items), ""}, std::move(compressed), ""}});
+    _nums.clear();
+    _header.clear();
+    _body.clear();
+  }
+};
+
+// Number of bytes needed to store val in an xref stream field.
+std::size_t field_width(unsigned long val) {
+  std::size_t width = 1;
+  while(val >>= 8)
+    width++;
+  return width;
+}
+
+/* Builds the xref stream with all keys of the trailer that still apply.
+   Its own entry must already be in xref. */
+pdf::Stream xref_stream(const std::vector<Entry>& xref, const pdf::TopLevelObject& trailer) {
+  unsigned long max2 = 0, max3 = 0;
+  for(const auto& e : xref) {
+    max2 = std::max(max2, static_cast<unsigned long>(e.offset));
+    max3 = std::max(max3, e.gen);
+  }
+  const std::size_t w[3] = {1, field_width(max2), field_width(max3)};
+  std::string data{};
+  data.reserve(xref.size() * (w[0] + w[1] + w[2]));
+  auto field = [&data](std::size_t width, unsigned long val) {
+    for(std::size_t i = width; i > 0; i--)
+      data.push_back(static_cast<char>(val >> (8 * (i - 1))));
+  };
+  for(const auto& e : xref) {
+    field(w[0], e.type == Entry::Type::used ? 1 : e.type == Entry::Type::compressed ? 2 : 0);
+    field(w[1], e.offset);
+    field(w[2], e.gen);
+  }
+  std::string compressed = pdf::codec::deflate(data);
+
+  pdf::Dictionary::Items items{};
+  if(trailer && trailer.get<pdf::Trailer>().dict().is<pdf::Dictionary>())
+    for(const auto& [key, val] : trailer.get<pdf::Trailer>().dict().get<pdf::Dictionary>().items())
+      if(key != pdf::names::Size && key != pdf::names::Prev && key != pdf::names::XRefStm
+          && key != pdf::names::Type && key != pdf::names::W && key != pdf::names::Index
+          && key != pdf::names::Filter && key != pdf::names::DecodeParms && key != pdf::names::Length)
+        items.emplace_back(key, val);
+  pdf::Array::Items wItems{};
+  for(std::size_t width : w)
+    wItems.push_back(pdf::Object{pdf::Numeric{static_cast<long>(width)}});
+  items.emplace_back(pdf::names::Type, pdf::Object{pdf::Name{pdf::names::XRef}});
+  items.emplace_back(pdf::names::Size, pdf::Object{pdf::Numeric{static_cast<long>(xref.size())}});
+  items.emplace_back(pdf::names::W, pdf::Object{pdf::Array{std::move(wItems), ""}});
+  items.emplace_back(pdf::names::Filter, pdf::Object{pdf::Name{"FlateDecode"}});
+  items.emplace_back(pdf::names::Length, pdf::Object{pdf::Numeric{static_cast<long>(compressed.length())}});
+  return {pdf::Dictionary{std::move(items), ""}, std::move(compressed), ""};
+}
+
+// Turns all unused entries into a linked list of free ones.
+void link_free(std::vector<Entry>& xref) {
+  unsigned long last_free = 0;
+  for(auto it = xref.rbegin(); it != xref.rend(); it++) {
+    if(it->type == Entry::Type::none || it->type == Entry::Type::free) {
+      *it = {Entry::Type::free, static_cast<std::streamoff>(last_free), 65535};
+      last_free = std::distance(it, xref.rend()) - 1;
+    }
+  }
+}
+
+// The classic xref table, all rows in one section.
+void write_xref_table(pdf::Writer& out, const std::vector<Entry>& xref) {
+  out.put("xref\n0 ");
+  out.put(static_cast<unsigned long>(xref.size()));
+  out.put('\n');
+  for(const auto& e : xref) {
+    char buf[21];
+    std::snprintf(buf, sizeof(buf), "%010lu %05lu %c \n", static_cast<unsigned long>(e.offset), e.gen,
+        e.type == Entry::Type::used ? 'n' : 'f');
+    out.put(std::string_view{buf, 20});
+  }
+}
+
+/* Selected pages of a document and the intermediate nodes above them in
+   the page tree, with the number of selected pages below each. */
+struct PageSelection {
+  std::set<pdf::ObjRef> pages;
+  std::map<pdf::ObjRef, unsigned long> nodes;
+
+  bool keeps(pdf::ObjRef ref) const { return pages.count(ref) != 0 || nodes.count(ref) != 0; }
+};
+
+// A copy of an intermediate node without the /Kids that aren't kept.
+pdf::Object prune_node(pdf::ObjRef ref, const pdf::Dictionary& dict, const PageSelection& sel) {
+  pdf::Dictionary::Items items{};
+  for(const auto& [key, val] : dict.items())
+    if(key != pdf::names::Kids && key != pdf::names::Count)
+      items.emplace_back(key, val);
+  pdf::Array::Items kids{};
+  const auto& oKids = dict.lookup(pdf::names::Kids);
+  for(const auto& kid : oKids.get<pdf::Array>().items())
+    if(kid.is<pdf::Indirect>() && sel.keeps(kid.get<pdf::Indirect>().ref()))
+      kids.push_back(kid);
+  items.emplace_back(pdf::names::Kids, pdf::Object{pdf::Array{std::move(kids), ""}});
+  items.emplace_back(pdf::names::Count, pdf::Object{pdf::Numeric{static_cast<long>(sel.nodes.at(ref))}});
+  return pdf::Object{pdf::Dictionary{std::move(items), ""}};
+}
+
+/* A copy of obj with references to the new numbers in nums. References to
+   objects left out become null, which is what they'd be read as. */
+pdf::Object renumber(const pdf::Object& obj, const std::map<pdf::ObjRef, unsigned long>& nums) {
+  auto dict = [&nums](const pdf::Dictionary& d) {
+    pdf::Dictionary::Items items{};
+    for(const auto& [key, val] : d.items())
+      items.emplace_back(key, renumber(val, nums));
+    return pdf::Dictionary{std::move(items), ""};
+  };
+  if(obj.is<pdf::Indirect>()) {
+    auto it = nums.find(obj.get<pdf::Indirect>().ref());
+    return it != nums.end() ? pdf::Object{pdf::Indirect{it->second, 0}} : pdf::Object{pdf::Null{}};
+  } else if(obj.is<pdf::Array>()) {
+    pdf::Array::Items items{};
+    for(const auto& item : obj.get<pdf::Array>().items())
+      items.push_back(renumber(item, nums));
+    return pdf::Object{pdf::Array{std::move(items), ""}};
+  } else if(obj.is<pdf::Dictionary>())
+    return pdf::Object{dict(obj.get<pdf::Dictionary>())};
+  else if(obj.is<pdf::Stream>()) {
+    // The data are shared, not copied
+    const auto& stm = obj.get<pdf::Stream>();
+    return pdf::Object{pdf::Stream{dict(stm.dict()), stm.data(), stm.owner(), ""}};
+  } else
+    return obj;
+}
+
+// The trailer keys which don't describe the xref, renumbered.
+pdf::Dictionary::Items trailer_items(const pdf::Object& trailer, const std::map<pdf::ObjRef, unsigned long>& nums) {
+  pdf::Dictionary::Items items{};
+  if(trailer.is<pdf::Dictionary>())
+    for(const auto& [key, val] : trailer.get<pdf::Dictionary>().items())
+      if(key != pdf::names::Size && key != pdf::names::Prev && key != pdf::names::XRefStm
+          && key != pdf::names::Type && key != pdf::names::W && key != pdf::names::Index
+          && key != pdf::names::Filter && key != pdf::names::DecodeParms && key != pdf::names::Length)
+        items.emplace_back(key, renumber(val, nums));
+  return items;
+}
+
+void usage(const char* argv0) {
+  std::cerr << "Usage: " << argv0 << " [-v] [-x] [-s] [-z[level]] [-j jobs] [in1.pdf|in1.obj] ...\n"
+    << "       " << argv0 << " [-v] [-x] [-s] [-z[level]] [-j jobs] -P pages in.pdf\n"
+    << "  -v, --verbatim        copy objects parsed without errors as their original bytes,\n"
+    << "                        large ones directly from the input\n"
+    << "  -x, --xref-stream     write a compressed xref stream instead of an xref table\n"
+    << "  -s, --object-streams  pack small objects into object streams (implies -x)\n"
+    << "  -z, --compress[=LEVEL] decode streams and compress them with /FlateDecode, where smaller;\n"
+    << "                        LEVEL as in zlib, 0 to 9\n"
+    << "  -j, --jobs=N          recompress in N worker threads, writing in another\n"
+    << "  -P, --pages=LIST      only these pages, e.g., 1-3,7,10-, and what they need, renumbered;\n"
+    << "                        located via the xref table of the input, which is parsed no further\n";
+}
+
+// Output is written whenever this much is collected
+constexpr std::size_t flushSize = 1 << 20;
+// In verbatim mode, objects at least this large bypass the output buffer
+constexpr std::size_t directSize = 64 << 10;
+// Initial arena for parsing one object, as in pdfbreak
+constexpr std::size_t arenaSize = 64 << 10;
+// Chunks of output waiting to be written, per thread
+constexpr std::size_t pendingPerThread = 4;
+
 int main(int argc, char* argv[]) {
-  if(argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " [in1.pdf|in1.obj] ...\n";
+  bool verbatim = false;
+  bool xrefStream = false;
+  bool objStreams = false;
+  std::vector<pdf::PageRange> ranges{};
+  bool compress = false;
+  int level = -1;
+  unsigned jobs = 0;
+  const option longopts[] = {
+    {"verbatim", no_argument, nullptr, 'v'},
+    {"xref-stream", no_argument, nullptr, 'x'},
+    {"object-streams", no_argument, nullptr, 's'},
+    {"pages", required_argument, nullptr, 'P'},
+    {"compress", optional_argument, nullptr, 'z'},
+    {"jobs", required_argument, nullptr, 'j'},
+    {nullptr, 0, nullptr, 0}
+  };
+  for(int opt; (opt = getopt_long(argc, argv, "vxsP:z::j:", longopts, nullptr)) != -1; ) {
+    switch(opt) {
+      case 'v':
+        verbatim = true;
+        break;
+      case 'x':
+        xrefStream = true;
+        break;
+      case 's':
+        xrefStream = objStreams = true;
+        break;
+      case 'P':
+        if(auto list = pdf::parsePageRanges(optarg))
+          ranges.insert(ranges.end(), list->begin(), list->end());
+        else {
+          std::cerr << "Invalid page list: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      case 'z':
+        compress = true;
+        if(int len; optarg && (std::sscanf(optarg, "%d%n", &level, &len) != 1 || optarg[len] != '\0'
+              || level < 0 || level > 9)) {
+          std::cerr << "Invalid compression level: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      case 'j':
+        if(int len; std::sscanf(optarg, "%u%n", &jobs, &len) != 1 || optarg[len] != '\0') {
+          std::cerr << "Invalid number of jobs: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if(optind == argc || (!ranges.empty() && argc - optind != 1)) {
+    usage(argv[0]);
     return 1;
   }
 
   std::string ofname = "out.pdf"; // TODO
-  std::ofstream ofs{ofname};
+  std::ofstream ofs{ofname, std::ios::binary};
   ofs << pdf::Version{1, 7};
 
-  std::vector<std::string> fnames{&argv[1], &argv[argc]};
-  std::map<pdf::ObjRef, std::streamoff> map{};
+  /* Objects are written in chunks: either a run of objects collected in
+     out, or one object prepared by a job in the pool, e.g., a stream being
+     recompressed. The chunks are written in order as they're ready, their
+     offsets are only known then, so the xref entries wait until the end. */
+  std::streamoff pos = ofs.tellp();
+  std::vector<std::streamoff> starts{};
+  pdf::WorkerPool pool{jobs, 2 * jobs};
+  pdf::OrderedWriter writer{[&](std::string_view data) {
+      starts.push_back(pos);
+      ofs.write(data.data(), data.length());
+      pos += data.length();
+    }, jobs > 0, pendingPerThread * (jobs + 1)};
+  // Used entries have offsets relative to their chunk
+  struct Placed {
+    unsigned long num;
+    Entry entry;
+    std::size_t chunk;
+  };
+  std::vector<Placed> placed{};
+  pdf::Writer out{verbatim};
+  std::optional<std::size_t> outChunk{};
+  auto flush = [&]() {
+    if(outChunk) {
+      writer.fill(*outChunk, std::string{out.data()});
+      out.clear();
+      outChunk.reset();
+    }
+  };
+  // An object about to be appended to out
+  auto place = [&](unsigned long num, unsigned long gen) {
+    if(!outChunk)
+      outChunk = writer.reserve();
+    placed.push_back({num, {Entry::Type::used, static_cast<std::streamoff>(out.size()), gen}, *outChunk});
+  };
+  // An object in a chunk of its own, which follows out
+  auto place_chunk = [&](unsigned long num, unsigned long gen) {
+    flush();
+    std::size_t chunk = writer.reserve();
+    placed.push_back({num, {Entry::Type::used, 0, gen}, chunk});
+    return chunk;
+  };
+
+  std::vector<std::byte> arenaBuf(arenaSize);
+  std::pmr::monotonic_buffer_resource arena{arenaBuf.data(), arenaBuf.size()};
+
+  std::vector<std::string> fnames{&argv[optind], &argv[argc]};
+  std::vector<Entry> xref{};
+  ObjStmPacker packer{};
   pdf::TopLevelObject trailer{};
+
+  // Returns false if a recompression job failed; the error is reported
+  auto write_named = [&](const pdf::TopLevelObject& tlo) {
+    auto& nmo = tlo.get<pdf::NamedObject>();
+    auto [num, gen] = nmo.numgen();
+    if(objStreams && ObjStmPacker::accepts(nmo)) {
+      // The location is filled in when the object stream is numbered
+      placed.push_back({num, {Entry::Type::compressed, 0, 0}, 0});
+      packer.add(nmo);
+      return true;
+    }
+    if(compress && nmo.object().is<pdf::Stream>() && !nmo.failed()) {
+      // A copy of the dictionary, the data are shared
+      auto stm = std::make_shared<const pdf::Stream>(nmo.object().get<pdf::Stream>());
+      try {
+        pool.submit([&writer, chunk = place_chunk(num, gen), num = num, gen = gen, stm, level] {
+          std::string text{};
+          try {
+            thread_local pdf::Writer w{};
+            w.clear();
+            pdf::TopLevelObject{pdf::NamedObject{num, gen, pdf::Object{pdf::recompress(*stm, level)}}}.dump(w, 0);
+            text = w.data();
+          } catch(...) {
+            // The writer waits for every chunk
+            writer.fill(chunk, std::string{});
+            throw;
+          }
+          writer.fill(chunk, std::move(text));
+        });
+      } catch(std::exception& e) {
+        std::cerr << "!!! " << e.what() << '\n';
+        // The jobs still queued refer to writer
+        try {
+          pool.wait();
+        } catch(std::exception&) { }
+        return false;
+      }
+      return true;
+    }
+    if(std::string_view source = nmo.source(); verbatim && source.length() >= directSize && !nmo.failed()) {
+      // Straight from the input (typically memory-mapped) to the file
+      writer.fill(place_chunk(num, gen), source, nmo.owner());
+      outChunk = writer.reserve();
+      out.put('\n');
+    } else {
+      place(num, gen);
+      tlo.dump(out, 0);
+    }
+    if(out.size() >= flushSize)
+      flush();
+    return true;
+  };
+
+  // With -P, the document's own trailer, /Size is added in the end
+  std::optional<pdf::Dictionary::Items> pagesTrailer{};
+  if(!ranges.empty()) {
+    const auto& fname = fnames.front();
+    auto input = pdf::openInput(fname);
+    if(!input) {
+      std::cerr << "Can't open " << fname << " for reading.\n";
+      return 1;
+    }
+    try {
+      pdf::Document doc{input.get()};
+      if(!doc.xrefError().empty())
+        std::clog << "Warning: " << doc.xrefError() << ", using reconstructed xref\n";
+      pdf::Resolver resolver{doc};
+      PageSelection sel{};
+      for(std::size_t ix : pdf::selectPages(ranges, resolver.pages().size())) {
+        pdf::ObjRef page = resolver.pages()[ix];
+        if(!sel.pages.insert(page).second)
+          continue;
+        for(pdf::ObjRef node : resolver.ancestors(page))
+          sel.nodes[node]++;
+      }
+      if(sel.pages.empty()) {
+        std::cerr << "!!! No such pages, the document has " << resolver.pages().size() << '\n';
+        return 1;
+      }
+      // Everything the trailer leads to, except the parts of the page tree left out
+      std::vector<pdf::ObjRef> roots{};
+      pdf::Resolver::references(doc.trailer(), roots);
+      auto refs = resolver.reachable(roots, [&](pdf::ObjRef ref, const pdf::TopLevelObject&) {
+        return !resolver.inPageTree(ref) || sel.keeps(ref);
+      });
+      // Numbered from 1 in the order found, so that the xref has no gaps
+      std::map<pdf::ObjRef, unsigned long> nums{};
+      for(pdf::ObjRef ref : refs)
+        if(doc.load(ref).is<pdf::NamedObject>())
+          nums.emplace(ref, nums.size() + 1);
+      for(pdf::ObjRef ref : refs) {
+        const auto& tlo = doc.load(ref);
+        if(tlo.is<pdf::Invalid>()) {
+          std::cerr << "!!! " << tlo.get<pdf::Invalid>().get_error() << '\n';
+          continue;
+        }
+        const auto& obj = tlo.get<pdf::NamedObject>().object();
+        pdf::Object contents = renumber(sel.nodes.count(ref) && obj.is<pdf::Dictionary>()
+            ? prune_node(ref, obj.get<pdf::Dictionary>(), sel) : obj, nums);
+        if(!write_named(pdf::TopLevelObject{pdf::NamedObject{nums.at(ref), 0, std::move(contents)}}))
+          return 1;
+      }
+      pagesTrailer = trailer_items(doc.trailer(), nums);
+    } catch(pdf::document_error& e) {
+      std::cerr << "!!! " << e.what() << '\n';
+      return 1;
+    }
+    fnames.clear();
+  }
+
   for(const auto& fname : fnames) {
-    std::ifstream ifs{fname, std::ios_base::in | std::ios_base::binary};
-    if(!ifs) {
+    auto input = pdf::openInput(fname);
+    if(!input) {
       std::cerr << "Can't open " << fname << " for reading.\n";
       continue;
     }
+    std::istream ifs{input.get()};
     pdf::TopLevelObject tlo{};
-    while(ifs >> tlo) {
+    while(true) {
+      // The objects are only needed until they're written, except the trailer, which is a copy
+      tlo = {};
+      arena.release();
+      {
+        pdf::ResourceScope scope{&arena};
+        ifs >> tlo;
+      }
+      if(!ifs)
+        break;
       if(tlo.is<pdf::NamedObject>()) {
-        auto& nmo = tlo.get<pdf::NamedObject>();
-        auto [num, gen] = nmo.numgen();
-        auto offset = ofs.tellp();
-        map[{num, gen}] = offset;
-        ofs << tlo;
+        if(!write_named(tlo))
+          return 1;
       } else if(tlo.is<pdf::XRefTable>())
         std::clog << "Skipping xref table\n";
       else if(tlo.is<pdf::Trailer>())
@@ -47,35 +500,63 @@ int main(int argc, char* argv[]) {
       std::clog << "Error reading " << fname << " at " << ifs.tellg() << '\n';
     }
   }
-  unsigned long max = 0;
-  for(const auto [key, val] : map) {
-    if(key.num > max)
-      max = key.num;
-  }
-  std::vector<std::tuple<unsigned long, unsigned long/*TODO*/, bool>> xrefs(max+1);
-  for(const auto [key, val] : map) {
-    xrefs[key.num] = {val, key.gen, true};
-  }
-  {
-    unsigned long last_free = 0;
-    for(auto it = xrefs.rbegin(); it != xrefs.rend(); it++) {
-      if(std::get<2>(*it) == false) {
-        std::get<0>(*it) = last_free;
-        std::get<1>(*it) = 65535;
-        last_free = std::distance(it, xrefs.rend()) - 1;
-      }
+  flush();
+  try {
+    pool.wait();
+    writer.finish();
+  } catch(std::exception& e) {
+    std::cerr << "!!! " << e.what() << '\n';
+    return 1;
+  }
+  for(const auto& [num, entry, chunk] : placed) {
+    Entry e = entry;
+    if(e.type == Entry::Type::used)
+      e.offset += starts[chunk];
+    set_entry(xref, num, e);
+  }
+  if(xref.empty())
+    xref.resize(1, {Entry::Type::none, 0, 0});
+
+  // The rest goes to the file directly
+  auto flush_direct = [&]() {
+    ofs.write(out.data().data(), out.size());
+    pos += out.size();
+    out.clear();
+  };
+
+  if(objStreams) {
+    unsigned long num = xref.size();
+    for(auto& [nums, stream] : packer.packed()) {
+      // Unless replaced by a direct object. Of duplicates, the later one wins.
+      for(std::size_t ix = 0; ix < nums.size(); ix++)
+        if(auto& e = xref[nums[ix]]; e.type == Entry::Type::compressed)
+          e = {Entry::Type::compressed, static_cast<std::streamoff>(num), ix};
+      set_entry(xref, num, {Entry::Type::used, pos + static_cast<std::streamoff>(out.size()), 0});
+      pdf::TopLevelObject{pdf::NamedObject{num, 0, {std::move(stream)}}}.dump(out, 0);
+      if(out.size() >= flushSize)
+        flush_direct();
+      num++;
     }
   }
-  auto xrefstart = ofs.tellp();
-  ofs << "xref\n"
-    << "0 " << xrefs.size() << '\n';
-  for(const auto [off, gen, used] : xrefs) {
-    char buf[21];
-    std::snprintf(buf, sizeof(buf), "%010lu %05lu %c \n", off, gen, used?'n':'f');
-    ofs << buf << std::flush;
+
+  if(pagesTrailer) {
+    pagesTrailer->emplace_back(pdf::names::Size, pdf::Object{pdf::Numeric{static_cast<long>(xref.size())}});
+    trailer = pdf::TopLevelObject{pdf::Trailer{pdf::Object{pdf::Dictionary{std::move(*pagesTrailer), ""}}, 0}};
   }
   if(!trailer)
     std::cerr << "!!! No trailer found; expect invalid PDF\n";
-  pdf::TopLevelObject startxref{pdf::StartXRef{xrefstart}};
-  ofs << trailer << startxref;
+  std::streamoff xrefstart = pos + out.size();
+  if(xrefStream) {
+    unsigned long num = xref.size();
+    set_entry(xref, num, {Entry::Type::used, xrefstart, 0});
+    link_free(xref);
+    pdf::Stream stm = xref_stream(xref, trailer);
+    pdf::TopLevelObject{pdf::NamedObject{num, 0, {std::move(stm)}}}.dump(out, 0);
+  } else {
+    link_free(xref);
+    write_xref_table(out, xref);
+    trailer.dump(out, 0);
+  }
+  pdf::TopLevelObject{pdf::StartXRef{xrefstart}}.dump(out, 0);
+  flush_direct();
 }
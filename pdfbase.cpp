@@ -1,55 +1,176 @@
-#include <cstdio>
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include "pdfbase.h"
 
 namespace pdf {
 
+/***** Memory for parsed objects *****/
+
+namespace {
+
+thread_local std::pmr::memory_resource* currentResource = nullptr;
+
+} // anonymous namespace
+
+std::pmr::memory_resource* objectResource() {
+  return currentResource ? currentResource : std::pmr::get_default_resource();
+}
+
+ResourceScope::ResourceScope(std::pmr::memory_resource* resource) : prev(currentResource) {
+  currentResource = resource;
+}
+
+ResourceScope::~ResourceScope() {
+  currentResource = prev;
+}
+
+/***** Interned names *****/
+
+namespace {
+
+struct SymbolTable {
+  std::shared_mutex mutex;
+  std::unordered_map<std::string_view, const std::string_view*> map;
+  // Stable storage for names added at runtime
+  std::deque<std::string> chars;
+  std::deque<std::string_view> views;
+
+  SymbolTable() {
+    for(const auto& name : internal::knownNames)
+      map.emplace(name, &name);
+  }
+
+  const std::string_view* find(std::string_view str) {
+    std::shared_lock lock{mutex};
+    auto it = map.find(str);
+    return it != map.end() ? it->second : nullptr;
+  }
+
+  const std::string_view* insert(std::string_view str) {
+    std::unique_lock lock{mutex};
+    if(auto it = map.find(str); it != map.end())
+      return it->second;
+    const auto& view = views.emplace_back(chars.emplace_back(str));
+    map.emplace(view, &view);
+    return &view;
+  }
+};
+
+SymbolTable& symbols() {
+  static SymbolTable table{};
+  return table;
+}
+
+// Spares taking the lock for names seen before in this thread
+thread_local std::unordered_map<std::string_view, Symbol> symbolCache{};
+
+} // anonymous namespace
+
+Symbol Symbol::intern(std::string_view str) {
+  if(auto it = symbolCache.find(str); it != symbolCache.end())
+    return it->second;
+  auto& table = symbols();
+  const std::string_view* ptr = table.find(str);
+  if(!ptr)
+    ptr = table.insert(str);
+  return symbolCache.emplace(*ptr, Symbol{ptr}).first->second;
+}
+
+std::optional<Symbol> Symbol::find(std::string_view str) {
+  if(auto it = symbolCache.find(str); it != symbolCache.end())
+    return it->second;
+  if(const std::string_view* ptr = symbols().find(str))
+    return symbolCache.emplace(*ptr, Symbol{ptr}).first->second;
+  return {};
+}
+
 /***** Implementation of PDF object classes *****/
 
 namespace {
 
-void print_offset(std::ostream& os, unsigned off, const std::string& text) {
-  os << std::string(2*off, ' ') << text;
+// Characters written as octal escapes in literal strings
+constexpr std::array<bool, 256> escapeChars = [] {
+  std::array<bool, 256> table{};
+  for(unsigned c = 0; c < 256; c++)
+    table[c] = c < 32 || c > 127 || c == '(' || c == ')' || c == '\\';
+  return table;
+}();
+
+constexpr std::string_view hexDigits = "0123456789ABCDEF";
+
+void put_error(Writer& w, unsigned off, std::string_view error) {
+  w.indent(off);
+  w.put("% !!! ");
+  w.put(error);
 }
 
 } // anonymous namespace
 
-void Null::dump(std::ostream& os, unsigned off) const {
-  print_offset(os, off, "null");
+void Null::dump(Writer& w, unsigned off) const {
+  w.indent(off);
+  w.put("null");
 }
 
-void Invalid::dump(std::ostream& os, unsigned off) const {
-  print_offset(os, off, "null");
-  os << '\n';
-  print_offset(os, off, "% !!! " + error);
+void Invalid::dump(Writer& w, unsigned off) const {
+  w.indent(off);
+  w.put("null\n");
+  put_error(w, off, error);
 }
 
-void Boolean::dump(std::ostream& os, unsigned off) const {
-  print_offset(os, off, val ? "true" : "false");
+void Boolean::dump(Writer& w, unsigned off) const {
+  w.indent(off);
+  w.put(val ? "true" : "false");
 }
 
-Numeric::Numeric(std::string str) {
-  if(str.empty()) {
-    dp = -1; //fail
-    return;
-  }
-  auto off = str.find('.');
-  char *last;
-  int dp_;
-  if(off != std::string::npos) {
-    str.erase(off, 1);
-    dp_ = str.length() - off;
-  } else
-    dp_ = 0;
-  int res = (int)strtol(str.data(), &last, 10);
-  if(last != str.data() + str.length()) {
-    dp = -1; //fail
-    return;
-  } else {
-    val_s = res;
-    dp = dp_;
+Numeric::Numeric(std::string_view str) : val_s(0), dp(-1) {
+  // Digits after the decimal point beyond this are dropped
+  constexpr int maxDp = 18;
+  const char* ptr = str.data();
+  const char* end = ptr + str.length();
+  // Most tokens probed here aren't numbers
+  if(ptr == end || !(((*ptr >= '0' && *ptr <= '9') || *ptr == '.' || *ptr == '+' || *ptr == '-')))
+    return; // fail
+  bool neg = *ptr == '-';
+  bool sign = neg || *ptr == '+';
+  if(sign)
+    ++ptr;
+  const unsigned long limit = static_cast<unsigned long>(std::numeric_limits<long>::max()) + (neg ? 1 : 0);
+  unsigned long mant = 0;
+  int frac = -1; // digits after '.', or -1 before it
+  bool digits = false, truncated = false;
+  for(; ptr != end; ++ptr) {
+    char c = *ptr;
+    if(c >= '0' && c <= '9') {
+      digits = true;
+      unsigned d = c - '0';
+      if(truncated || frac >= maxDp)
+        continue;
+      if(mant > (limit - d) / 10) {
+        if(frac < 0)
+          return; // fail: integer part out of range
+        truncated = true;
+        continue;
+      }
+      mant = mant * 10 + d;
+      if(frac >= 0)
+        frac++;
+    } else if(c == '.' && frac < 0)
+      frac = 0;
+    else
+      return; // fail
   }
+  // A lone "." reads as 0, as it always did
+  if(!digits && sign)
+    return; // fail
+  val_s = !neg || mant == 0 ? static_cast<long>(mant) : -static_cast<long>(mant - 1) - 1;
+  dp = frac < 0 ? 0 : frac;
 }
 
 long Numeric::val_long() const {
@@ -74,95 +195,194 @@ unsigned long Numeric::val_ulong() const {
   return ret;
 }
 
-void Numeric::dump(std::ostream& os, unsigned off) const {
+void Numeric::dump(Writer& w, unsigned off) const {
   assert(!failed());
-  char buf[20];
-  std::snprintf(buf, 20, "%0*li", dp + (val_s < 0 ? 1 : 0) + 1, val_s);
-  std::string str{buf};
-  if(dp > 0)
-    str.insert(str.length() - dp, 1, '.');
-  print_offset(os, off, str);
+  w.indent(off);
+  unsigned long abs = val_s < 0 ? 0ul - static_cast<unsigned long>(val_s) : val_s;
+  // At least one digit before the decimal point
+  char buf[24];
+  char* ptr = buf + sizeof(buf);
+  for(int i = 0; i <= dp || abs != 0; i++) {
+    *--ptr = static_cast<char>('0' + abs % 10);
+    abs /= 10;
+  }
+  if(val_s < 0)
+    w.put('-');
+  std::size_t len = buf + sizeof(buf) - ptr;
+  w.put(std::string_view{ptr, len - dp});
+  if(dp > 0) {
+    w.put('.');
+    w.put(std::string_view{buf + sizeof(buf) - dp, static_cast<std::size_t>(dp)});
+  }
 }
 
-void String::dump(std::ostream& os, unsigned off) const {
+void String::dump(Writer& w, unsigned off) const {
+  w.indent(off);
   if(hex) {
-    print_offset(os, off, "< ");
-    for(char c : val) {
-      char buf[4];
-      snprintf(buf, sizeof(buf), "%02X ", (unsigned char)c);
-      os << buf;
+    w.put("< ");
+    for(unsigned char c : val) {
+      w.put(hexDigits[c >> 4]);
+      w.put(hexDigits[c & 15]);
+      w.put(' ');
     }
-    os << '>';
+    w.put('>');
   } else {
-    print_offset(os, off, "(");
-    for(char c : val) {
-      if(c >= 32 && (unsigned char)c <= 127 && c != '(' && c != ')' && c != '\\')
-        os << c;
-      else {
-        char buf[5];
-        snprintf(buf, sizeof(buf), "\\%03o", (unsigned char)c);
-        os << buf;
-      }
+    w.put('(');
+    const char* ptr = val.data();
+    const char* end = ptr + val.length();
+    while(ptr != end) {
+      // Runs of printable characters are copied at once
+      const char* run = ptr;
+      while(ptr != end && !escapeChars[static_cast<unsigned char>(*ptr)])
+        ++ptr;
+      w.put(std::string_view{run, static_cast<std::size_t>(ptr - run)});
+      if(ptr == end)
+        break;
+      unsigned char c = *ptr++;
+      w.put('\\');
+      w.put(static_cast<char>('0' + (c >> 6)));
+      w.put(static_cast<char>('0' + ((c >> 3) & 7)));
+      w.put(static_cast<char>('0' + (c & 7)));
     }
-    os << ')';
+    w.put(')');
   }
   if(!error.empty()) {
-    os << '\n';
-    print_offset(os, off, "% !!! " + error);
+    w.put('\n');
+    put_error(w, off, error);
   }
 }
 
-void Name::dump(std::ostream& os, unsigned off) const {
-  print_offset(os, off, "/" + val);
+Name::Name(std::string_view val_) : _sym(nullptr), _rep(nullptr) {
+  if(auto sym = Symbol::find(val_))
+    _sym = *sym;
+  else
+    _rep = make(objectResource(), val_);
+}
+
+Name::Rep* Name::make(std::pmr::memory_resource* res, std::string_view str) {
+  auto* rep = new(res->allocate(sizeof(Rep) + str.length(), alignof(Rep))) Rep{res, str.length()};
+  std::copy(str.begin(), str.end(), rep->chars());
+  return rep;
 }
 
-void Array::dump(std::ostream& os, unsigned off) const {
-  print_offset(os, off, "[\n");
+void Name::dump(Writer& w, unsigned off) const {
+  w.indent(off);
+  w.put('/');
+  w.put(std::string_view{*this});
+}
+
+void Array::dump(Writer& w, unsigned off) const {
+  w.indent(off);
+  w.put("[\n");
   for(const auto& o : val) {
-    o.dump(os, off+1);
-    os << '\n';
+    o.dump(w, off+1);
+    w.put('\n');
   }
-  if(!error.empty())
-    print_offset(os, off + 1, "% !!! " + error + "\n");
-  print_offset(os, off, "]");
+  if(!error.empty()) {
+    put_error(w, off + 1, error);
+    w.put('\n');
+  }
+  w.indent(off);
+  w.put(']');
 }
 
-void Dictionary::dump(std::ostream& os, unsigned off) const {
-  print_offset(os, off, "<<\n");
-  for(const auto& [k, v] : val) {
-    print_offset(os, off+1, "/" + k + "\n");
-    v.dump(os, off+2);
-    os << '\n';
+void Dictionary::dump(Writer& w, unsigned off) const {
+  std::vector<const Items::value_type*> sorted{};
+  sorted.reserve(val.size());
+  for(const auto& kv : val)
+    sorted.push_back(&kv);
+  std::sort(sorted.begin(), sorted.end(),
+      [](const auto* a, const auto* b) { return a->first.str() < b->first.str(); });
+  w.indent(off);
+  w.put("<<\n");
+  for(const auto* kv : sorted) {
+    w.indent(off+1);
+    w.put('/');
+    w.put(kv->first.str());
+    w.put('\n');
+    kv->second.dump(w, off+2);
+    w.put('\n');
   }
-  if(!error.empty())
-    print_offset(os, off + 1, "% !!! " + error + "\n");
-  print_offset(os, off, ">>");
+  if(!error.empty()) {
+    put_error(w, off + 1, error);
+    w.put('\n');
+  }
+  w.indent(off);
+  w.put(">>");
+}
+
+void Dictionary::sort() {
+  std::sort(val.begin(), val.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
 }
 
 static const Object null{};
 
-const Object& Dictionary::lookup(const std::string& key) const {
-  auto it = val.find(key);
-  if(it == val.end())
+const Object& Dictionary::lookup(Symbol key) const {
+  // Most dictionaries are small enough that a linear search is faster
+  constexpr std::size_t linearMax = 8;
+  if(val.size() <= linearMax) {
+    for(const auto& [k, v] : val)
+      if(k == key)
+        return v;
     return null;
-  else
-    return it->second;
+  }
+  auto it = std::lower_bound(val.begin(), val.end(), key,
+      [](const auto& kv, Symbol key) { return kv.first < key; });
+  return it != val.end() && it->first == key ? it->second : null;
 }
 
-void Stream::dump(std::ostream& os, unsigned off) const {
-  _dict.dump(os, off);
-  os << "\nstream\n";
-  os.write(_data.data(), _data.length());
-  os << "\nendstream";
+const Object& Dictionary::lookup(std::string_view key) const {
+  auto sym = Symbol::find(key);
+  return sym ? lookup(*sym) : null;
+}
+
+void Stream::dump(Writer& w, unsigned off) const {
+  _dict.dump(w, off);
+  w.put("\nstream\n");
+  w.putData(_data);
+  w.put("\nendstream");
   if(!_error.empty()) {
-    os << '\n';
-    print_offset(os, off, "% !!! " + _error);
+    w.put('\n');
+    put_error(w, off, _error);
   }
 }
 
-void Indirect::dump(std::ostream& os, unsigned off) const {
-  print_offset(os, off, "");
-  os << num << ' ' << gen << " R";
+void Indirect::dump(Writer& w, unsigned off) const {
+  w.indent(off);
+  w.put(num);
+  w.put(' ');
+  w.put(gen);
+  w.put(" R");
+}
+
+/***** iostream interface *****/
+
+namespace {
+
+// Index for std::ios_base::iword()
+int verbatimIndex() {
+  static const int index = std::ios_base::xalloc();
+  return index;
+}
+
+} // anonymous namespace
+
+Writer& internal::streamWriter(std::ostream& os) {
+  thread_local Writer w{};
+  w.clear();
+  w.verbatim(os.iword(verbatimIndex()) != 0);
+  w.target(&os);
+  return w;
+}
+
+std::ios_base& verbatim(std::ios_base& os) {
+  os.iword(verbatimIndex()) = 1;
+  return os;
+}
+
+std::ios_base& noverbatim(std::ios_base& os) {
+  os.iword(verbatimIndex()) = 0;
+  return os;
 }
 
 } //namespace pdf
@@ -1,10 +1,17 @@
 #ifndef PDF_BASE_H
 #define PDF_BASE_H
 
+#include <algorithm>
+#include <functional>
 #include <ostream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <type_traits>
 #include <variant>
 
 namespace pdf {
@@ -23,21 +30,260 @@ inline bool operator== (const ObjRef& lhs, const ObjRef& rhs) {
   return lhs.num == rhs.num && lhs.gen == rhs.gen;
 }
 
+/***** Memory for parsed objects *****/
+
+/* Strings, names, arrays and dictionaries allocate from the resource returned
+   by objectResource(), which is std::pmr::get_default_resource() unless a
+   ResourceScope is active in the current thread. Copies of objects always
+   use the default resource, so they are safe to keep after an arena is
+   released; moved objects keep the resource of the original. */
+std::pmr::memory_resource* objectResource();
+
+class ResourceScope {
+  std::pmr::memory_resource* prev;
+
+  public:
+  ResourceScope(std::pmr::memory_resource* resource);
+  ResourceScope(const ResourceScope&) = delete;
+  ResourceScope& operator=(const ResourceScope&) = delete;
+  ~ResourceScope();
+};
+
+/***** Interned names *****/
+
+/* Equal names are represented by the same Symbol for the lifetime of the
+   program, so comparing Symbols only compares pointers. The table is shared
+   by all threads and never shrinks, so only dictionary keys and the names
+   below are interned; other Name values use a Symbol only if it exists. */
+class Symbol {
+  const std::string_view* _str;
+
+  public:
+  constexpr explicit Symbol(const std::string_view* str_) : _str(str_) { }
+
+  static Symbol intern(std::string_view str);
+  // Doesn't add to the table; a name which isn't there can't be a key.
+  static std::optional<Symbol> find(std::string_view str);
+
+  std::string_view str() const { return *_str; }
+
+  friend bool operator== (Symbol lhs, Symbol rhs) { return lhs._str == rhs._str; }
+  friend bool operator!= (Symbol lhs, Symbol rhs) { return lhs._str != rhs._str; }
+  // Not alphabetical, only for sorting
+  friend bool operator< (Symbol lhs, Symbol rhs) { return std::less<>{}(lhs._str, rhs._str); }
+
+  friend struct std::hash<Symbol>;
+};
+
+namespace internal {
+
+// Preinterned names for use by the library
+inline constexpr std::string_view knownNames[] = {
+  "BitsPerComponent", "Colors", "Columns", "Count", "CropBox", "DecodeParms",
+  "EarlyChange", "Filter", "First", "Index", "Kids", "Length", "MediaBox", "N",
+  "ObjStm", "Pages", "Predictor", "Prev", "Resources", "Root", "Rotate",
+  "Size", "Type", "W", "XRef", "XRefStm"
+};
+
+constexpr Symbol knownSymbol(std::string_view str) {
+  for(const auto& name : knownNames)
+    if(name == str)
+      return Symbol{&name};
+  throw std::logic_error("Name not in knownNames");
+}
+
+} // namespace pdf::internal
+
+namespace names {
+
+inline constexpr Symbol BitsPerComponent = internal::knownSymbol("BitsPerComponent");
+inline constexpr Symbol Colors = internal::knownSymbol("Colors");
+inline constexpr Symbol Columns = internal::knownSymbol("Columns");
+inline constexpr Symbol Count = internal::knownSymbol("Count");
+inline constexpr Symbol CropBox = internal::knownSymbol("CropBox");
+inline constexpr Symbol DecodeParms = internal::knownSymbol("DecodeParms");
+inline constexpr Symbol EarlyChange = internal::knownSymbol("EarlyChange");
+inline constexpr Symbol Filter = internal::knownSymbol("Filter");
+inline constexpr Symbol First = internal::knownSymbol("First");
+inline constexpr Symbol Index = internal::knownSymbol("Index");
+inline constexpr Symbol Kids = internal::knownSymbol("Kids");
+inline constexpr Symbol Length = internal::knownSymbol("Length");
+inline constexpr Symbol MediaBox = internal::knownSymbol("MediaBox");
+inline constexpr Symbol N = internal::knownSymbol("N");
+inline constexpr Symbol ObjStm = internal::knownSymbol("ObjStm");
+inline constexpr Symbol Pages = internal::knownSymbol("Pages");
+inline constexpr Symbol Predictor = internal::knownSymbol("Predictor");
+inline constexpr Symbol Prev = internal::knownSymbol("Prev");
+inline constexpr Symbol Resources = internal::knownSymbol("Resources");
+inline constexpr Symbol Root = internal::knownSymbol("Root");
+inline constexpr Symbol Rotate = internal::knownSymbol("Rotate");
+inline constexpr Symbol Size = internal::knownSymbol("Size");
+inline constexpr Symbol Type = internal::knownSymbol("Type");
+inline constexpr Symbol W = internal::knownSymbol("W");
+inline constexpr Symbol XRef = internal::knownSymbol("XRef");
+inline constexpr Symbol XRefStm = internal::knownSymbol("XRefStm");
+
+} // namespace pdf::names
+
+} // namespace pdf
+
+template<>
+struct std::hash<pdf::Symbol> {
+  std::size_t operator()(pdf::Symbol sym) const { return std::hash<const void*>{}(sym._str); }
+};
+
+namespace pdf {
+
+/***** Serialization *****/
+
+/* Objects are serialized by dump(), which appends their text to a Writer.
+   This is a contiguous growable buffer: clear() keeps the allocation up to
+   keepCapacity, so a Writer reused for many objects stops allocating. If
+   verbatim() is set, objects that were parsed without errors and remember
+   their original bytes (see NamedObject) are written as those instead.
+   With a target(), large data such as stream contents go straight there
+   instead of being copied into the buffer, see putData(). */
+class Writer {
+  std::string _data;
+  bool _verbatim;
+  std::ostream* _target;
+
+  public:
+  static constexpr std::size_t keepCapacity = 4 << 20;
+  // Data this large bypass the buffer if there's a target
+  static constexpr std::size_t directSize = 64 << 10;
+
+  Writer(bool verbatim_ = false) : _data{}, _verbatim(verbatim_), _target(nullptr) { }
+
+  // Only what hasn't gone to the target yet
+  std::string_view data() const { return _data; }
+  std::size_t size() const { return _data.size(); }
+  void clear() {
+    if(_data.capacity() > keepCapacity)
+      _data = std::string{};
+    else
+      _data.clear();
+  }
+
+  void target(std::ostream* os) { _target = os; }
+  // Writes the buffer to the target, if any.
+  void flush() {
+    if(_target) {
+      _target->write(_data.data(), _data.size());
+      clear();
+    }
+  }
+
+  bool verbatim() const { return _verbatim; }
+  void verbatim(bool verbatim_) { _verbatim = verbatim_; }
+
+  void put(char c) { _data.push_back(c); }
+  void put(std::string_view str) { _data.append(str); }
+  void putData(std::string_view str) {
+    if(_target && str.length() >= directSize) {
+      flush();
+      _target->write(str.data(), str.length());
+    } else
+      put(str);
+  }
+
+  // 2*off spaces
+  void indent(unsigned off) {
+    constexpr std::string_view spaces = "                                ";
+    for(std::size_t len = 2 * off; len > 0; ) {
+      std::size_t n = std::min(len, spaces.length());
+      _data.append(spaces.data(), n);
+      len -= n;
+    }
+  }
+
+  void put(unsigned long val) {
+    char buf[20];
+    char* ptr = buf + sizeof(buf);
+    do
+      *--ptr = static_cast<char>('0' + val % 10);
+    while(val /= 10);
+    _data.append(ptr, buf + sizeof(buf) - ptr);
+  }
+
+  void put(long val) {
+    if(val < 0) {
+      put('-');
+      // Negating in unsigned arithmetic works for LONG_MIN too
+      put(0ul - static_cast<unsigned long>(val));
+    } else
+      put(static_cast<unsigned long>(val));
+  }
+};
+
 namespace internal {
 
+/* Object types don't have virtual functions: a tagged_union dispatches
+   dump() and failed() to its alternatives by std::visit. It doesn't derive
+   from ObjBase itself, that would keep the variant from starting at
+   offset 0. */
 class ObjBase {
   public:
-  virtual void dump(std::ostream& os, unsigned off) const = 0;
-  virtual bool failed() const { return false; }
+  bool failed() const { return false; }
+};
 
-  protected:
-  virtual ~ObjBase() { }
+/* Owns a T allocated from objectResource(). Alternatives too large to be
+   stored in an Object directly are boxed, so that Object stays small. Like
+   the containers, copies use the default resource. A moved-from Boxed may
+   only be destroyed or assigned to. */
+template<typename T>
+class Boxed {
+  T* _ptr;
+  std::pmr::memory_resource* _res;
+
+  template<typename U>
+  Boxed(std::pmr::memory_resource* res, U&& val)
+    : _ptr(static_cast<T*>(res->allocate(sizeof(T), alignof(T)))), _res(res)
+  {
+    try {
+      new(_ptr) T(std::forward<U>(val));
+    } catch(...) {
+      _res->deallocate(_ptr, sizeof(T), alignof(T));
+      throw;
+    }
+  }
+
+  public:
+  Boxed(T&& val) : Boxed(objectResource(), std::move(val)) { }
+  Boxed(const T& val) : Boxed(std::pmr::get_default_resource(), val) { }
+  Boxed(const Boxed& other) : Boxed(std::pmr::get_default_resource(), *other) { }
+  Boxed(Boxed&& other) noexcept : _ptr(other._ptr), _res(other._res) { other._ptr = nullptr; }
+  Boxed& operator=(Boxed other) noexcept {
+    std::swap(_ptr, other._ptr);
+    std::swap(_res, other._res);
+    return *this;
+  }
+  ~Boxed() {
+    if(_ptr) {
+      _ptr->~T();
+      _res->deallocate(_ptr, sizeof(T), alignof(T));
+    }
+  }
+
+  const T& operator*() const { return *_ptr; }
+  T& operator*() { return *_ptr; }
+
+  bool failed() const { return _ptr->failed(); }
+  void dump(Writer& w, unsigned off) const { _ptr->dump(w, off); }
 };
 
+template<typename T, typename... Ts>
+inline constexpr bool contains_v = (std::is_same_v<T, Ts> || ...);
+
+/* The alternatives of tagged_union<..., Boxed<T>, ...> are accessed as
+   is<T>() and get<T>() too. */
 template<typename... Ts>
-class tagged_union : public ObjBase {
+class tagged_union {
   std::variant<Ts...> contents;
 
+  template<typename T>
+  using stored_t = std::conditional_t<contains_v<T, Ts...>, T, Boxed<T>>;
+
   public:
 
   tagged_union() = default;
@@ -50,20 +296,30 @@ class tagged_union : public ObjBase {
   ~tagged_union() = default;
 
   template<typename T>
-  bool is() const { return std::holds_alternative<T>(contents); }
+  bool is() const { return std::holds_alternative<stored_t<T>>(contents); }
 
   template<typename T>
-  const T& get() const { return std::get<T>(contents); }
+  const T& get() const {
+    if constexpr(contains_v<T, Ts...>)
+      return std::get<T>(contents);
+    else
+      return *std::get<Boxed<T>>(contents);
+  }
 
   template<typename T>
-  T&& get() && { return std::move(std::get<T>(contents)); }
+  T&& get() && {
+    if constexpr(contains_v<T, Ts...>)
+      return std::move(std::get<T>(contents));
+    else
+      return std::move(*std::get<Boxed<T>>(contents));
+  }
 
-  bool failed() const override {
+  bool failed() const {
     return std::visit([](auto&& arg) { return arg.failed(); }, contents);
   }
 
-  void dump(std::ostream& os, unsigned off) const override {
-    std::visit([&os, off](auto&& arg) { arg.dump(os, off); }, contents);
+  void dump(Writer& w, unsigned off) const {
+    std::visit([&w, off](auto&& arg) { arg.dump(w, off); }, contents);
   }
 };
 
@@ -72,10 +328,11 @@ class tagged_union : public ObjBase {
 /***** PDF object types *****/
 
 struct Object;
+class DecoderChain;
 
 class Null : public internal::ObjBase {
   public:
-  void dump(std::ostream& os, unsigned off) const override;
+  void dump(Writer& w, unsigned off) const;
 };
 
 class Boolean : public internal::ObjBase {
@@ -86,7 +343,7 @@ class Boolean : public internal::ObjBase {
 
   operator bool() const { return val; }
 
-  void dump(std::ostream& os, unsigned off) const override;
+  void dump(Writer& w, unsigned off) const;
 };
 
 class Numeric : public internal::ObjBase {
@@ -95,95 +352,169 @@ class Numeric : public internal::ObjBase {
 
   public:
   Numeric(long val) : val_s(val), dp(0) { }
-  Numeric(std::string str);
+  Numeric(std::string_view str);
 
   bool integral() const { return dp == 0; }
   bool uintegral() const { return integral() && val_s >= 0; }
-  bool failed() const override { return dp < 0; }
+  bool failed() const { return dp < 0; }
   bool valid() const { return !failed(); }
 
   long val_long() const;
   unsigned long val_ulong() const;
 
-  void dump(std::ostream& os, unsigned off) const override;
+  void dump(Writer& w, unsigned off) const;
 };
 
 class String : public internal::ObjBase {
-  std::string val;
+  std::pmr::string val;
   bool hex;
   std::string error;
 
   public:
-  template<typename V, typename E>
-  String(V&& val_, bool hex_, E&& err_)
-    : val(std::forward<V>(val_)), hex(hex_), error(std::forward<E>(err_)) { }
+  template<typename E>
+  String(std::pmr::string&& val_, bool hex_, E&& err_)
+    : val(std::move(val_)), hex(hex_), error(std::forward<E>(err_)) { }
 
-  operator const std::string&() const { return val; }
+  operator std::string_view() const { return val; }
 
-  bool failed() const override { return !error.empty(); }
-  void dump(std::ostream& os, unsigned off) const override;
+  bool failed() const { return !error.empty(); }
+  void dump(Writer& w, unsigned off) const;
 };
 
+/* A name already interned when the Name is made, such as a dictionary key
+   or one of names::, is kept as its Symbol, and comparing it with Symbols
+   compares pointers. Others are not added to the table: their characters
+   are allocated from objectResource() after a header recording the
+   resource and the length. Two words, so that Object stays small. Copies
+   use the default resource. A moved-from Name may only be destroyed or
+   assigned to. */
 class Name : public internal::ObjBase {
-  std::string val;
+  struct Rep {
+    std::pmr::memory_resource* res;
+    std::size_t len;
+
+    char* chars() { return reinterpret_cast<char*>(this + 1); }
+    const char* chars() const { return reinterpret_cast<const char*>(this + 1); }
+  };
+  Symbol _sym; // only valid without _rep
+  Rep* _rep;
+
+  static Rep* make(std::pmr::memory_resource* res, std::string_view str);
 
   public:
-  template<typename V>
-  Name(V&& val_) : val(std::forward<V>(val_)) { }
+  Name(std::string_view val_);
+  Name(Symbol val_) : _sym(val_), _rep(nullptr) { }
+  Name(const Name& other)
+    : _sym(other._sym), _rep(other._rep ? make(std::pmr::get_default_resource(), other) : nullptr) { }
+  Name(Name&& other) noexcept : _sym(other._sym), _rep(other._rep) { other._rep = nullptr; }
+  Name& operator=(Name other) noexcept {
+    std::swap(_sym, other._sym);
+    std::swap(_rep, other._rep);
+    return *this;
+  }
+  ~Name() {
+    if(_rep)
+      _rep->res->deallocate(_rep, sizeof(Rep) + _rep->len, alignof(Rep));
+  }
+
+  // Empty if the name wasn't interned when this was made
+  std::optional<Symbol> symbol() const { return _rep ? std::nullopt : std::optional{_sym}; }
 
-  operator const std::string&() const { return val; }
-  bool operator== (const char* cstr) const { return val == cstr; }
+  operator std::string_view() const { return _rep ? std::string_view{_rep->chars(), _rep->len} : _sym.str(); }
+  bool operator== (std::string_view str) const { return std::string_view{*this} == str; }
+  // The table may have got sym only after this was made, then the strings are compared
+  bool operator== (Symbol sym) const { return _rep ? std::string_view{*this} == sym.str() : _sym == sym; }
 
-  void dump(std::ostream& os, unsigned off) const override;
+  void dump(Writer& w, unsigned off) const;
 };
 
 class Array : public internal::ObjBase {
-  std::vector<Object> val;
+  public:
+  using Items = std::pmr::vector<Object>;
+
+  private:
+  Items val;
   std::string error;
 
   public:
-  template<typename V, typename E>
-  Array(V&& val_, E&& err_)
-    : val(std::forward<V>(val_)), error(std::forward<E>(err_)) { }
+  template<typename E>
+  Array(Items&& val_, E&& err_)
+    : val(std::move(val_)), error(std::forward<E>(err_)) { }
 
-  const std::vector<Object>& items() const { return val; }
+  const Items& items() const { return val; }
 
-  bool failed() const override { return !error.empty(); }
-  void dump(std::ostream& os, unsigned off) const override;
+  bool failed() const { return !error.empty(); }
+  void dump(Writer& w, unsigned off) const;
 };
 
+/* Entries are kept in a flat vector sorted by Symbol, which is not the
+   alphabetical order. dump() writes them in alphabetical order. */
 class Dictionary : public internal::ObjBase {
-  std::map<std::string, Object> val;
+  public:
+  using Items = std::pmr::vector<std::pair<Symbol, Object>>;
+
+  private:
+  Items val;
   std::string error;
 
   public:
-  template<typename V, typename E>
-  Dictionary(V&& val_, E&& err_)
-    : val(std::forward<V>(val_)), error(std::forward<E>(err_)) { }
+  // The keys must be unique
+  template<typename E>
+  Dictionary(Items&& val_, E&& err_)
+    : val(std::move(val_)), error(std::forward<E>(err_))
+  {
+    sort();
+  }
+
+  const Items& items() const { return val; }
+  const Object& lookup(Symbol key) const;
+  const Object& lookup(std::string_view key) const;
 
-  const Object& lookup(const std::string& key) const;
+  bool failed() const { return !error.empty(); }
+  void dump(Writer& w, unsigned off) const;
 
-  bool failed() const override { return !error.empty(); }
-  void dump(std::ostream& os, unsigned off) const override;
+  private:
+  void sort();
 };
 
 class Stream : public internal::ObjBase {
   Dictionary _dict;
-  std::string _data;
+  std::string_view _data;
+  std::shared_ptr<const void> _owner; // keeps the memory _data refers to alive
   std::string _error;
 
   public:
-  template<typename D, typename V, typename E>
-  Stream(D&& dict_, V&& data_, E&& err_)
+  // Takes ownership of the data
+  template<typename D, typename E>
+  Stream(D&& dict_, std::string&& data_, E&& err_)
     : _dict(std::forward<D>(dict_)),
-      _data(std::forward<V>(data_)),
+      _data(),
+      _owner(),
+      _error(std::forward<E>(err_))
+  {
+    auto owned = std::make_shared<const std::string>(std::move(data_));
+    _data = *owned;
+    _owner = std::move(owned);
+  }
+
+  // Refers to data owned by someone else, e.g., a memory-mapped file
+  template<typename D, typename E>
+  Stream(D&& dict_, std::string_view data_, std::shared_ptr<const void> owner_, E&& err_)
+    : _dict(std::forward<D>(dict_)),
+      _data(data_),
+      _owner(std::move(owner_)),
       _error(std::forward<E>(err_)) { }
 
   const Dictionary& dict() const { return _dict; }
-  const std::string& data() const { return _data; }
+  std::string_view data() const { return _data; }
+  const std::shared_ptr<const void>& owner() const { return _owner; }
+
+  /* Decodes the data as they are read from the result, which keeps them
+     alive. readAhead is as in DecoderChain. Defined in pdffilter.cpp. */
+  DecoderChain decoder(std::size_t readAhead = 0) const;
 
-  bool failed() const override { return _dict.failed() || !_error.empty(); }
-  void dump(std::ostream& os, unsigned off) const override;
+  bool failed() const { return _dict.failed() || !_error.empty(); }
+  void dump(Writer& w, unsigned off) const;
 };
 
 class Indirect : public internal::ObjBase {
@@ -193,7 +524,9 @@ class Indirect : public internal::ObjBase {
   public:
   Indirect(unsigned long num_, unsigned long gen_) : num(num_), gen(gen_) { }
 
-  void dump(std::ostream& os, unsigned off) const override;
+  ObjRef ref() const { return {num, gen}; }
+
+  void dump(Writer& w, unsigned off) const;
 };
 
 class Invalid : public internal::ObjBase {
@@ -204,34 +537,52 @@ class Invalid : public internal::ObjBase {
 
   const std::string& get_error() const { return error; }
 
-  bool failed() const override { return true; }
-  void dump(std::ostream& os, unsigned off) const override;
+  bool failed() const { return true; }
+  void dump(Writer& w, unsigned off) const;
 };
 
+// Alternatives larger than two words are boxed
 using _Object = internal::tagged_union<
     Null,
     Boolean,
     Numeric,
-    String,
+    internal::Boxed<String>,
     Name,
-    Array,
-    Dictionary,
-    Stream,
+    internal::Boxed<Array>,
+    internal::Boxed<Dictionary>,
+    internal::Boxed<Stream>,
     Indirect,
-    Invalid>;
+    internal::Boxed<Invalid>>;
 
 struct Object : public _Object {
   using _Object::_Object;
   operator bool() const { return !is<Null>() && !is<Invalid>(); }
 };
 
+static_assert(sizeof(Object) <= 3 * sizeof(void*), "Object should stay at three words");
+
 /***** iostream interface *****/
 
-inline std::ostream& operator<< (std::ostream& os, const internal::ObjBase& obj) {
-  obj.dump(os, 0);
+namespace internal {
+
+// Reused by operator<<, verbatim() is set from the stream's flag, os is the target
+Writer& streamWriter(std::ostream& os);
+
+} // namespace pdf::internal
+
+template<typename T, typename = decltype(std::declval<const T&>().dump(std::declval<Writer&>(), 0))>
+std::ostream& operator<< (std::ostream& os, const T& obj) {
+  Writer& w = internal::streamWriter(os);
+  obj.dump(w, 0);
+  w.flush();
+  w.target(nullptr);
   return os;
 }
 
+// Manipulators for Writer::verbatim() in operator<<
+std::ios_base& verbatim(std::ios_base& os);
+std::ios_base& noverbatim(std::ios_base& os);
+
 } // namespace pdf
 
 #endif
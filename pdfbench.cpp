@@ -0,0 +1,220 @@
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "pdf.h"
+
+/* Microbenchmarks of the parser and the decoders on inputs built here, and
+   of whole-file parsing on the files given, e.g., from pdfgen. Each case
+   runs until minTime has passed, the best run is reported. */
+
+constexpr double minTime = 0.5;
+constexpr unsigned minRuns = 3;
+
+// Keeps results alive, so the compiler can't drop the work
+volatile std::size_t sink;
+
+template<typename F>
+void bench(const std::string& name, std::size_t bytes, F run) {
+  using clock = std::chrono::steady_clock;
+  double best = 1e30, total = 0;
+  for(unsigned runs = 0; runs < minRuns || total < minTime; runs++) {
+    auto start = clock::now();
+    sink = run();
+    double t = std::chrono::duration<double>(clock::now() - start).count();
+    best = std::min(best, t);
+    total += t;
+  }
+  std::printf("%-32s %10.1f MB/s %12.3f ms\n", name.c_str(), bytes / best / 1e6, best * 1e3);
+  std::fflush(stdout);
+}
+
+/* A plain streambuf over a string, standing in for inputs that aren't
+   InputBuffers, e.g., pipes or std::filebuf. */
+class StringReader : public std::streambuf {
+  public:
+  StringReader(const std::string& data) {
+    char* begin = const_cast<char*>(data.data());
+    setg(begin, begin, begin + data.length());
+  }
+
+  protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+    char* base = dir == std::ios_base::beg ? eback() : dir == std::ios_base::cur ? gptr() : egptr();
+    if(base + off < eback() || base + off > egptr())
+      return pos_type(off_type(-1));
+    setg(eback(), base + off, egptr());
+    return gptr() - eback();
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+std::string repeat(const std::string& str, std::size_t count) {
+  std::string ret{};
+  ret.reserve(str.length() * count);
+  for(std::size_t i = 0; i < count; i++)
+    ret += str;
+  return ret;
+}
+
+// Number of tokens until EOF.
+std::size_t tokenize(std::streambuf* input) {
+  pdf::parser::TokenParser ts{input};
+  std::size_t count = 0;
+  while(!ts.read().eof())
+    count++;
+  return count;
+}
+
+// Number of objects read until EOF, each in the arena.
+std::size_t readObjects(std::string_view data) {
+  pdf::InputBuffer buf{data};
+  pdf::parser::TokenParser ts{&buf};
+  std::vector<std::byte> arenaBuf(64 << 10);
+  std::pmr::monotonic_buffer_resource arena{arenaBuf.data(), arenaBuf.size()};
+  std::size_t count = 0;
+  while(!ts.peek().eof()) {
+    arena.release();
+    pdf::ResourceScope scope{&arena};
+    if(pdf::parser::readObject(ts).failed())
+      break;
+    count++;
+  }
+  return count;
+}
+
+// Number of top-level objects read until EOF, as pdfbreak does.
+std::size_t readTopLevel(std::streambuf* input) {
+  std::istream is{input};
+  std::vector<std::byte> arenaBuf(64 << 10);
+  std::pmr::monotonic_buffer_resource arena{arenaBuf.data(), arenaBuf.size()};
+  std::size_t count = 0;
+  pdf::TopLevelObject tlo{};
+  while(true) {
+    tlo = {};
+    arena.release();
+    {
+      pdf::ResourceScope scope{&arena};
+      is >> tlo;
+    }
+    if(is.eof())
+      break;
+    is.clear();
+    if(tlo.is<pdf::Invalid>() && !(is >> pdf::skipToEndObj))
+      break;
+    count++;
+  }
+  return count;
+}
+
+void benchParser() {
+  const std::string dicts = repeat("<< /Type /Annot /Subtype /Link /Rect [12 10 200.5 -3.25] /Border [0 0 0] "
+      "/Dest [12 0 R /XYZ null null 0] /T (Title \\(1\\)) /ID <0123456789abcdef> >>\n", 20000);
+  const std::string arrays = repeat("[1 0 R 2 0 R 3.5 -4 5 6 0 R /N 7 8 9 10 11 12 0 R 13 14 15 16]\n", 30000);
+  bench("tokenize/memory", dicts.length(), [&] {
+    pdf::InputBuffer buf{dicts};
+    return tokenize(&buf);
+  });
+  bench("tokenize/streambuf", dicts.length(), [&] {
+    StringReader buf{dicts};
+    return tokenize(&buf);
+  });
+  bench("readObject/dictionaries", dicts.length(), [&] { return readObjects(dicts); });
+  bench("readObject/arrays", arrays.length(), [&] { return readObjects(arrays); });
+
+  const std::string data = repeat("some stream data, lines of it\n", 300);
+  std::string withLength{}, noLength{};
+  for(int i = 1; i <= 2000; i++) {
+    withLength += std::to_string(i) + " 0 obj\n<< /Length " + std::to_string(data.length())
+      + " >>\nstream\n" + data + "\nendstream\nendobj\n";
+    noLength += std::to_string(i) + " 0 obj\n<< >>\nstream\n" + data + "\nendstream\nendobj\n";
+  }
+  bench("parseStream/length", withLength.length(), [&] {
+    pdf::InputBuffer buf{withLength};
+    return readTopLevel(&buf);
+  });
+  bench("parseStream/no-length", noLength.length(), [&] {
+    pdf::InputBuffer buf{noLength};
+    return readTopLevel(&buf);
+  });
+  bench("parseStream/no-length-streambuf", noLength.length(), [&] {
+    StringReader buf{noLength};
+    return readTopLevel(&buf);
+  });
+}
+
+void benchDecoders() {
+  std::string plain{};
+  for(int i = 0; i < 400000; i++)
+    plain += "q 1 0 0 1 " + std::to_string(i % 612) + " " + std::to_string(i % 792) + " cm /Im1 Do Q\n";
+  const std::string compressed = pdf::codec::deflate(plain);
+  std::vector<char> out(plain.length());
+  bench("DeflateDecoder", plain.length(), [&] {
+    pdf::InputBuffer buf{compressed};
+    pdf::codec::DeflateDecoder dd{&buf};
+    return static_cast<std::size_t>(dd.sgetn(out.data(), out.size()));
+  });
+  bench("DeflateDecoder/small-reads", plain.length(), [&] {
+    pdf::InputBuffer buf{compressed};
+    pdf::codec::DeflateDecoder dd{&buf};
+    std::size_t total = 0;
+    for(std::streamsize len; (len = dd.sgetn(out.data(), 4096)) > 0; )
+      total += len;
+    return total;
+  });
+  pdf::Dictionary::Items items{};
+  items.emplace_back(pdf::names::Filter, pdf::Object{pdf::Name{"FlateDecode"}});
+  const pdf::Stream stm{pdf::Dictionary{std::move(items), ""}, std::string{compressed}, ""};
+  // Per stream, as in pdfbreak --head
+  bench("DecoderChain/prefix", 64, [&] { return stm.decoder(64).read(64).length(); });
+}
+
+void benchObjStream() {
+  constexpr unsigned long count = 5000;
+  std::string header{}, body{};
+  for(unsigned long i = 0; i < count; i++) {
+    header += std::to_string(i + 10) + ' ' + std::to_string(body.length()) + ' ';
+    body += "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica /Widths [" + std::to_string(i) + " 250 333 500] >>\n";
+  }
+  header += '\n';
+  pdf::Dictionary::Items items{};
+  items.emplace_back(pdf::names::Type, pdf::Object{pdf::Name{pdf::names::ObjStm}});
+  items.emplace_back(pdf::names::N, pdf::Object{pdf::Numeric{static_cast<long>(count)}});
+  items.emplace_back(pdf::names::First, pdf::Object{pdf::Numeric{static_cast<long>(header.length())}});
+  const pdf::Stream stm{pdf::Dictionary{std::move(items), ""}, header + body, ""};
+  bench("ObjStream::read", stm.data().length(), [&] {
+    pdf::parser::ObjStream objstm{stm};
+    std::size_t n = 0;
+    while(objstm.read())
+      n++;
+    return n;
+  });
+}
+
+void benchFile(const std::string& filename) {
+  auto input = pdf::openInput(filename);
+  auto* mem = dynamic_cast<pdf::InputBuffer*>(input.get());
+  if(!mem) {
+    std::cerr << "Can't open " << filename << " for reading.\n";
+    return;
+  }
+  bench("file/" + filename, mem->data().length(), [&] {
+    pdf::InputBuffer buf{mem->data(), mem->owner()};
+    return readTopLevel(&buf);
+  });
+}
+
+int main(int argc, char* argv[]) {
+  benchParser();
+  benchDecoders();
+  benchObjStream();
+  for(int i = 1; i < argc; i++)
+    benchFile(argv[i]);
+}
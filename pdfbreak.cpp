@@ -1,14 +1,158 @@
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <optional>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <cstdio>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "pdf.h"
 
-std::tuple<std::string, bool> save_data(const pdf::Stream& stm, const std::string& basename) {
+// What happened to one input, for the summary in batch mode.
+struct FileStatus {
+  std::string name;
+  std::atomic<unsigned long> saved{0};
+  std::atomic<unsigned long> errors{0};
+  int result = 0;
+};
+
+// Where and how the output goes, shared by everything below.
+struct Output {
+  pdf::OutputSink& sink;
+  pdf::WorkerPool& pool;
+  bool decompress;
+  bool verbatim;
+  std::size_t head; // only this many bytes of decoded data, 0 for all
+  bool latest; // live objects only, those in object streams are saved separately
+  pdf::ResultCache* cache; // may be null
+  FileStatus& status;
+  bool batch; // name the input in error messages
+};
+
+void report_error(const Output& out, const std::string& error) {
+  out.status.errors++;
+  if(out.batch)
+    std::cerr << "!!! " + out.status.name + ": " + error + '\n';
+  else
+    std::cerr << "!!! " + error + '\n';
+}
+
+void report_saved(const Output& out, const std::string& log) {
+  out.status.saved++;
+  std::clog << log;
+}
+
+/* Wraps a job for the pool so that whatever it throws is reported as an
+   error of its file. The pool would rethrow it from the next submit(),
+   past any handler. */
+template<typename Job>
+std::function<void()> guarded(const Output& out, Job job) {
+  return [&out, job = std::move(job)] {
+    try {
+      job();
+    } catch(std::exception& e) {
+      report_error(out, e.what());
+    }
+  };
+}
+
+/* Files are prepared in memory, the buffers are reused for the next one.
+   Decoded data larger than maxBuffered are streamed instead. */
+constexpr std::size_t maxBuffered = pdf::OutputBuffer::keepCapacity;
+// Decoded data are read in pieces of this size
+constexpr std::size_t chunkSize = 64 << 10;
+// Upper limit of --head, far beyond any stream
+constexpr std::size_t maxHead = std::size_t{1} << 40;
+
+pdf::OutputBuffer& buffer() {
+  thread_local pdf::OutputBuffer buf{};
+  buf.clear();
+  return buf;
+}
+
+pdf::Writer& writer(const Output& out) {
+  thread_local pdf::Writer w{};
+  w.clear();
+  w.verbatim(out.verbatim);
+  return w;
+}
+
+bool save(const Output& out, const std::string& filename, std::string_view contents) {
+  try {
+    pdf::stats::ScopedTimer timer{pdf::stats::Timer::output};
+    out.sink.write(filename, contents);
+    pdf::stats::add(pdf::stats::Counter::outputFiles);
+    pdf::stats::add(pdf::stats::Counter::outputBytes, contents.length());
+    return true;
+  } catch(std::system_error& e) {
+    report_error(out, e.what());
+    return false;
+  }
+}
+
+// Changes whenever the cached results would be written differently
+constexpr std::string_view cacheVersion = "1";
+
+/* Identifies what is computed from a stream: the raw data, and the
+   dictionary for the filters and their parameters. */
+pdf::ContentKey stream_key(const Output& out, std::string_view kind, const pdf::Stream& stm) {
+  pdf::Writer w{};
+  stm.dict().dump(w, 0);
+  return {cacheVersion, kind, out.verbatim ? "verbatim" : "", w.data(), stm.data()};
+}
+
+std::optional<std::string> cache_get(const Output& out, const pdf::ContentKey& key) {
+  return out.cache ? out.cache->get(key) : std::nullopt;
+}
+
+// Failing to cache a result isn't fatal.
+void cache_put(const Output& out, const pdf::ContentKey& key, std::string_view contents) {
+  if(!out.cache)
+    return;
+  try {
+    out.cache->put(key, contents);
+  } catch(std::system_error& e) {
+    std::cerr << "!!! Cache: " + std::string{e.what()} + '\n';
+  }
+}
+
+/* Decoded stream data are cached as the extension, a line with 1 if
+   decoding failed, else 0, and the file contents. With out.head, only the
+   beginning is decoded, the rest of the stream is never touched. */
+std::tuple<std::string, bool> save_data(const Output& out, const pdf::Stream& stm, const std::string& basename) {
+  std::optional<pdf::ContentKey> key{};
+  if(out.cache) {
+    key = stream_key(out, out.head ? "head" + std::to_string(out.head) : "data", stm);
+    if(auto cached = cache_get(out, *key)) {
+      std::string_view contents{*cached};
+      auto nl1 = contents.find('\n');
+      if(nl1 != std::string_view::npos && contents.length() >= nl1 + 3 && contents[nl1 + 2] == '\n') {
+        std::string filename = basename + "." + std::string{contents.substr(0, nl1)};
+        bool errors = contents[nl1 + 1] == '1';
+        if(!save(out, filename, contents.substr(nl1 + 3)))
+          errors = true;
+        return {filename, errors};
+      }
+    }
+  }
+  auto& buf = buffer();
   try {
-    pdf::DecoderChain dd{stm};
+    auto dd = stm.decoder(out.head);
     std::string ext;
     if(dd.complete())
       ext = "data.d";
@@ -24,132 +168,773 @@ std::tuple<std::string, bool> save_data(const pdf::Stream& stm, const std::strin
         ext = "data";
     }
     std::string filename = basename + "." + ext;
-    std::ofstream ofs{filename};
     bool errors = false;
-    ofs.exceptions(std::ios::failbit);
+    // Up to maxBuffered in memory, beyond that to the sink as it's decoded
+    std::unique_ptr<pdf::OutputFile> file{};
+    std::size_t total = 0;
+    auto put = [&](std::string_view data) {
+      total += data.length();
+      if(!file && buf.size() + data.length() > maxBuffered) {
+        file = out.sink.open(filename);
+        file->write(buf.data());
+        buf.clear();
+      }
+      if(file)
+        file->write(data);
+      else
+        buf.sputn(data.data(), data.length());
+    };
     try {
-      ofs << dd.rdbuf();
+      try {
+        // In pieces, so that data before an error are kept
+        std::array<char, chunkSize> chunk;
+        for(std::size_t left = out.head ? out.head : SIZE_MAX; left > 0; ) {
+          std::size_t want = std::min(left, chunk.size());
+          std::size_t len = dd.read(chunk.data(), want);
+          put({chunk.data(), len});
+          if(len < want)
+            break;
+          left -= len;
+        }
+        if(total == 0)
+          put("% (empty stream)");
+      }
+      catch(pdf::codec::decode_error& e) {
+        put(std::string{"\n% !!! "} + e.what());
+        errors = true;
+      }
+      if(file) {
+        // Too large to be cached
+        pdf::stats::ScopedTimer timer{pdf::stats::Timer::output};
+        file->close();
+        pdf::stats::add(pdf::stats::Counter::outputFiles);
+        pdf::stats::add(pdf::stats::Counter::outputBytes, total);
+        return {filename, errors};
+      }
+    } catch(std::system_error& e) {
+      report_error(out, e.what());
+      return {filename, true};
     }
-    catch(pdf::codec::decode_error& e) {
-      ofs.clear();
-      ofs << "\n% !!! " << e.what();
+    if(key)
+      cache_put(out, *key, ext + (errors ? "\n1\n" : "\n0\n") + std::string{buf.data()});
+    if(!save(out, filename, buf.data()))
       errors = true;
-    }
-    catch(std::ios::failure& e) {
-      ofs.clear();
-      ofs << "% (empty stream)";
-    }
     return {filename, errors};
   } catch(pdf::codec::decode_error& e) {
-    std::cerr << "!!! " << e.what() << '\n';
+    report_error(out, e.what());
     std::string filename = basename + ".data";
-    std::ofstream ofs{filename};
-    ofs << stm.data();
+    save(out, filename, stm.data());
     return {filename, true};
   }
 }
 
-void unpack_objstm(const pdf::Stream& stm, const std::string& basename) {
+std::string objstm_filename(const std::string& basename, unsigned long num) {
+  std::ostringstream oss{};
+  oss << basename << '-' << num << ".obj";
+  return oss.str();
+}
+
+/* Unpacked object streams are cached as a header line "num failed size"
+   followed by the dump, for each object, and a last line "end failed". */
+bool unpack_cached(const Output& out, std::string_view cached, const std::string& basename) {
+  while(!cached.empty()) {
+    auto nl = cached.find('\n');
+    if(nl == std::string_view::npos)
+      return false;
+    std::string line{cached.substr(0, nl)};
+    cached.remove_prefix(nl + 1);
+    unsigned long num;
+    int failed;
+    std::size_t size;
+    if(std::sscanf(line.c_str(), "end %d", &failed) == 1) {
+      if(failed)
+        report_error(out, "Error reading from ObjStream");
+      else
+        std::clog << "Reading ObjStream successful\n";
+      return true;
+    }
+    if(std::sscanf(line.c_str(), "%lu %d %zu", &num, &failed, &size) != 3 || size > cached.length())
+      return false;
+    std::string filename = objstm_filename(basename, num);
+    if(save(out, filename, cached.substr(0, size)))
+      report_saved(out, "Saved: " + filename + (failed ? " (errors)\n" : "\n"));
+    cached.remove_prefix(size);
+  }
+  return false;
+}
+
+void unpack_objstm(const Output& out, const pdf::Stream& stm, const std::string& basename) {
   std::clog << "Entering ObjStream\n";
+  std::optional<pdf::ContentKey> key{};
+  if(out.cache) {
+    key = stream_key(out, "objstm", stm);
+    if(auto cached = cache_get(out, *key); cached && unpack_cached(out, *cached, basename))
+      return;
+  }
   try {
     pdf::parser::ObjStream objstm{stm};
     pdf::TopLevelObject tlo;
+    std::string toCache{};
     while(tlo = objstm.read()) {
       assert(tlo.is<pdf::NamedObject>());
       auto [num, gen] = tlo.get<pdf::NamedObject>().numgen();
-      std::string filename = [&basename, num] {
-        std::ostringstream oss{};
-        oss << basename << '-' << num << ".obj";
-        return oss.str();
-      }();
-      std::ofstream ofs{filename};
-      ofs << tlo;
-      std::clog << "Saved: " << filename << (tlo.failed() ? " (errors)\n" : "\n");
+      std::string filename = objstm_filename(basename, num);
+      auto& w = writer(out);
+      tlo.dump(w, 0);
+      if(key)
+        toCache += std::to_string(num) + (tlo.failed() ? " 1 " : " 0 ") + std::to_string(w.size()) + '\n'
+          + std::string{w.data()};
+      if(save(out, filename, w.data()))
+        report_saved(out, "Saved: " + filename + (tlo.failed() ? " (errors)\n" : "\n"));
     }
+    if(key)
+      cache_put(out, *key, toCache + (tlo.failed() ? "end 1\n" : "end 0\n"));
     if(tlo.failed()) {
-      std::cerr << "!!! Error reading from ObjStream\n";
+      report_error(out, "Error reading from ObjStream");
       return;
     }
     std::clog << "Reading ObjStream successful\n";
   } catch(pdf::codec::decode_error& e) {
-    std::cerr << "!!! " << e.what() << '\n';
+    report_error(out, e.what());
   } catch(pdf::parser::objstm_error& e) {
-    std::cerr << "!!! " << e.what() << '\n';
-    auto [filename, errors] = save_data(stm, basename);
-    std::clog << "Saved data: " << filename << (errors ? " (errors)\n" : "\n");
+    report_error(out, e.what());
+    auto [filename, errors] = save_data(out, stm, basename);
+    report_saved(out, "Saved data: " + filename + (errors ? " (errors)\n" : "\n"));
   }
 }
 
-int main(int argc, char* argv[]) {
-  if(argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " filename.pdf\n";
+void save_named(const Output& out, const pdf::TopLevelObject& tlo, const std::string& prefix) {
+  const auto& nmo = tlo.get<pdf::NamedObject>();
+  std::string basename = [&nmo, &prefix]() {
+    std::ostringstream oss{};
+    auto [num, gen] = nmo.numgen();
+    oss << prefix << '-' << num << '.' << gen;
+    return oss.str();
+  }();
+  std::string filename = basename + ".obj";
+  auto& w = writer(out);
+  tlo.dump(w, 0);
+  std::string log = "Saved: " + filename + (tlo.failed() ? " (errors)\n" : "\n");
+  if(out.pool.threads() > 0) {
+    // The object is serialized here as it lives in the parser's arena,
+    // only the write goes to the pool
+    out.pool.submit(guarded(out, [&out, filename, contents = std::string{w.data()}, log] {
+      if(save(out, filename, contents))
+        report_saved(out, log);
+    }));
+  } else if(save(out, filename, w.data()))
+    report_saved(out, log);
+  const auto& obj = nmo.object();
+  if(obj.is<pdf::Stream>()) {
+    // This only copies the dictionary, the data are shared
+    auto stm = std::make_shared<const pdf::Stream>(obj.get<pdf::Stream>());
+    if(const auto& val = stm->dict().lookup(pdf::names::Type);
+        val.is<pdf::Name>() && val.get<pdf::Name>() == pdf::names::ObjStm) {
+      if(!out.latest)
+        out.pool.submit(guarded(out, [&out, stm, basename] { unpack_objstm(out, *stm, basename); }));
+    }
+    else if(out.decompress) {
+      out.pool.submit(guarded(out, [&out, stm, basename] {
+        auto [filename, errors] = save_data(out, *stm, basename);
+        report_saved(out, "Saved data: " + filename + (errors ? " (errors)\n" : "\n"));
+      }));
+    }
+  }
+}
+
+std::optional<pdf::ObjRef> parse_objref(const char* str) {
+  unsigned long num, gen = 0;
+  int len;
+  // sscanf would also take signs and spaces
+  if(str[std::strspn(str, "0123456789.")] != '\0')
+    return {};
+  if(std::sscanf(str, "%lu%n.%lu%n", &num, &len, &gen, &len) < 1 || str[len] != '\0')
+    return {};
+  return pdf::ObjRef{num, gen};
+}
+
+// Loads an object via the xref and saves it, returns false if it's missing or broken.
+bool save_ref(const Output& out, pdf::Document& doc, pdf::ObjRef ref, const std::string& prefix) {
+  const auto& tlo = doc.load(ref);
+  if(tlo.is<pdf::NamedObject>()) {
+    save_named(out, tlo, prefix);
+    return true;
+  }
+  if(tlo.is<pdf::Invalid>())
+    report_error(out, tlo.get<pdf::Invalid>().get_error());
+  else
+    report_error(out, "Object " + std::to_string(ref.num) + ' ' + std::to_string(ref.gen) + " not in xref table");
+  return false;
+}
+
+void warn_xref(const pdf::Document& doc) {
+  if(!doc.xrefError().empty())
+    std::clog << "Warning: " << doc.xrefError() << ", using reconstructed xref\n";
+}
+
+int extract(const Output& out, std::streambuf* input, const std::string& prefix,
+    const std::vector<pdf::ObjRef>& objects) {
+  try {
+    pdf::Document doc{input};
+    warn_xref(doc);
+    int ret = 0;
+    for(const auto& ref : objects)
+      if(!save_ref(out, doc, ref, prefix))
+        ret = 1;
+    return ret;
+  } catch(pdf::document_error& e) {
+    report_error(out, e.what());
     return 1;
   }
+}
 
-  std::ifstream ifs{argv[1], std::ios_base::in | std::ios_base::binary};
-  if(!ifs) {
-    std::cerr << "Can't open " << argv[1] << " for reading.\n";
+/* Saves what each of the pages needs, as found by Resolver::pageObjects(),
+   named like file.pdf-page3-12.0.obj. Objects shared by pages are saved
+   with each, other pages and everything else are never parsed. */
+int extract_pages(const Output& out, std::streambuf* input, const std::string& prefix,
+    const std::vector<pdf::PageRange>& ranges) {
+  try {
+    pdf::Document doc{input};
+    warn_xref(doc);
+    pdf::Resolver resolver{doc};
+    std::size_t count = resolver.pages().size();
+    auto selected = pdf::selectPages(ranges, count);
+    if(selected.empty()) {
+      report_error(out, "No such pages, the document has " + std::to_string(count));
+      return 1;
+    }
+    int ret = 0;
+    for(std::size_t ix : selected) {
+      std::string pagePrefix = prefix + "-page" + std::to_string(ix + 1);
+      for(const auto& ref : resolver.pageObjects(ix))
+        if(!save_ref(out, doc, ref, pagePrefix))
+          ret = 1;
+    }
+    return ret;
+  } catch(pdf::document_error& e) {
+    report_error(out, e.what());
     return 1;
   }
+}
 
-  bool decompress = true; // TODO
+/* Saves the newest revision only: every object in the xref chain from the
+   last startxref, in file order, then those in object streams, by stream.
+   Superseded objects, older trailers and free entries are never parsed. */
+int extract_latest(const Output& out, std::streambuf* input, const std::string& prefix) {
+  using Entry = pdf::Document::Entry;
+  try {
+    pdf::Document doc{input};
+    warn_xref(doc);
+    std::vector<std::pair<Entry, unsigned long>> direct{}, compressed{};
+    for(unsigned long num = 1; num < doc.size(); num++)
+      if(const Entry& e = doc.entry(num); e.type == Entry::Type::used)
+        direct.emplace_back(e, num);
+      else if(e.type == Entry::Type::compressed)
+        compressed.emplace_back(e, num);
+    auto byOffset = [](const auto& a, const auto& b) {
+      return a.first.offset != b.first.offset ? a.first.offset < b.first.offset : a.first.gen < b.first.gen;
+    };
+    std::sort(direct.begin(), direct.end(), byOffset);
+    std::sort(compressed.begin(), compressed.end(), byOffset);
+    int ret = 0;
+    auto save_live = [&](pdf::ObjRef ref) {
+      auto tlo = doc.read(ref);
+      if(tlo.is<pdf::NamedObject>())
+        save_named(out, tlo, prefix);
+      else {
+        report_error(out, tlo.is<pdf::Invalid>() ? tlo.get<pdf::Invalid>().get_error()
+            : "Object " + std::to_string(ref.num) + ' ' + std::to_string(ref.gen) + " not found");
+        ret = 1;
+      }
+    };
+    for(const auto& [e, num] : direct)
+      save_live({num, e.gen});
+    for(std::size_t i = 0; i < compressed.size(); i++) {
+      const auto& [e, num] = compressed[i];
+      save_live({num, 0});
+      // Each object stream is decoded once and dropped when done
+      if(i + 1 == compressed.size() || compressed[i + 1].first.offset != e.offset)
+        doc.releaseObjStream(e.offset);
+    }
+    if(const auto& dict = doc.trailer(); dict.is<pdf::Dictionary>()) {
+      std::string filename = prefix + "-trailer.obj";
+      auto& w = writer(out);
+      pdf::Trailer{pdf::Object{dict}, 0}.dump(w, 0);
+      if(save(out, filename, w.data()))
+        report_saved(out, "Saving: " + filename + '\n');
+    }
+    return ret;
+  } catch(pdf::document_error& e) {
+    report_error(out, e.what());
+    return 1;
+  }
+}
+
+// Handles anything but Invalid found at the top level of the file.
+void process(const Output& out, const pdf::TopLevelObject& tlo, const std::string& filename) {
+  if(tlo.is<pdf::NamedObject>()) {
+    save_named(out, tlo, filename);
+  } else if(tlo.is<pdf::XRefTable>()) {
+    std::clog << "Skipping xref table\n";
+  } else if(tlo.is<pdf::Trailer>()) {
+    const auto& trailer = tlo.get<pdf::Trailer>();
+    std::ostringstream oss{};
+    oss << filename << "-trailer-" << trailer.start() << ".obj";
+    auto& w = writer(out);
+    trailer.dump(w, 0);
+    if(save(out, oss.str(), w.data()))
+      report_saved(out, "Saving: " + oss.str() + '\n');
+  } else if(tlo.is<pdf::StartXRef>()) {
+    std::clog << "Skipping startxref marker\n";
+  }
+}
+
+void report_invalid(const Output& out, const pdf::TopLevelObject& tlo) {
+  std::string error = tlo.get<pdf::Invalid>().get_error();
+  assert(!error.empty());
+  report_error(out, error);
+}
+
+// Like process(), for objects coming from parseSplit() or PushParser.
+void process_parsed(const Output& out, const pdf::parser::ParsedObject& po, const std::string& filename) {
+  if(!po.tlo.is<pdf::Invalid>())
+    process(out, po.tlo, filename);
+  else {
+    report_invalid(out, po.tlo);
+    if(po.recovered)
+      std::clog << "Skipping past endobj at " + std::to_string(po.end) + '\n';
+    else
+      std::clog << "End of file reached seeking enobj\n";
+  }
+}
+
+// Reads from pipes
+constexpr std::size_t streamChunk = 64 << 10;
+// Enough to hold the %PDF-x.y line
+constexpr std::size_t headSize = 16;
+
+/* Reads a pipe or another input that can't seek, parsing objects as soon
+   as they have arrived. Returns false on a read error. */
+bool read_stream(const Output& out, int fd, const std::string& filename,
+    std::pmr::monotonic_buffer_resource& arena) {
+  pdf::parser::PushParser parser{};
+  std::vector<char> chunk(streamChunk);
+  // The header is checked once there's enough to see it
+  std::string head{};
+  bool headChecked = false;
+  auto checkHeader = [&]() {
+    pdf::InputBuffer buf{head};
+    std::istream is{&buf};
+    if(pdf::Version v{}; !(is >> v))
+      std::clog << "Warning: PDF header missing\n";
+    headChecked = true;
+  };
+  auto drain = [&]() {
+    while(true) {
+      std::optional<pdf::parser::ParsedObject> po{};
+      arena.release();
+      {
+        pdf::ResourceScope scope{&arena};
+        po = parser.next();
+      }
+      if(!po)
+        break;
+      process_parsed(out, *po, filename);
+    }
+  };
+  while(!parser.done()) {
+    ssize_t len = ::read(fd, chunk.data(), chunk.size());
+    if(len == -1) {
+      if(errno == EINTR)
+        continue;
+      report_error(out, std::string{"Read error: "} + std::strerror(errno));
+      return false;
+    }
+    if(len == 0)
+      break;
+    if(!headChecked) {
+      head.append(chunk.data(), std::min<std::size_t>(len, headSize - head.length()));
+      if(head.length() == headSize || head.find_first_of("\r\n") != std::string::npos)
+        checkHeader();
+    }
+    parser.feed({chunk.data(), static_cast<std::size_t>(len)});
+    drain();
+  }
+  if(!headChecked)
+    checkHeader();
+  parser.finish();
+  drain();
+  return true;
+}
+
+// Waits for all pending jobs and completes the output, returns false if any failed.
+bool finish(pdf::WorkerPool& pool, pdf::OutputSink& sink) {
+  try {
+    pool.wait();
+    sink.close();
+    return true;
+  } catch(std::exception& e) {
+    std::cerr << "!!! " << e.what() << '\n';
+    return false;
+  }
+}
+
+void usage(const char* argv0) {
+  std::cerr << "Usage: " << argv0 << " [-j jobs [-p]] [-o num[.gen]]... [-P pages] [-L] [-a archive.tar] [-v] [--inflate=backend] [--cache=DIR] {filename.pdf... | -T list}\n"
+    << "  -j, --jobs=N            decode streams in N worker threads, with several inputs also parse them\n"
+    << "  -p, --parallel-parse    also split the file and parse the parts in the threads\n"
+    << "      --inflate=BACKEND   zlib or libdeflate (if compiled in)\n"
+    << "  -o, --object=num[.gen]  extract only this object, located via the xref table\n"
+    << "  -P, --pages=LIST        extract only what these pages need, e.g., 1-3,7,10-, each page separately\n"
+    << "  -L, --latest            only the newest revision of each object, located via the xref\n"
+    << "  -a, --archive=FILE      write all output into a single tar archive\n"
+    << "  -v, --verbatim          save objects parsed without errors as their original bytes\n"
+    << "      --cache=DIR         reuse decoded streams from earlier runs, kept in DIR\n"
+    << "      --cache-size=MB     limit of the cache, least recently used results are dropped\n"
+    << "      --head=N            decode only the first N bytes of each stream, e.g., to identify contents\n"
+    << "  -T, --files-from=FILE   read the names of the inputs from FILE, one per line\n"
+    << "      --stats=json        print counters and timings to stdout in the end (if built with STATS=1)\n"
+    << "A filename of - reads stdin. Pipes are parsed as the data arrive.\n"
+    << "With several inputs, a summary of each is printed in the end.\n";
+}
+
+// Long options without a short form
+constexpr int opt_inflate = 256;
+constexpr int opt_cache = 257;
+constexpr int opt_cache_size = 258;
+constexpr int opt_stats = 259;
+constexpr int opt_head = 260;
+
+// Amount of input per parsing job in -p mode
+constexpr std::size_t splitChunk = 1 << 20;
+// Initial arena for parsing one object, enough for all but large dictionaries
+constexpr std::size_t arenaSize = 64 << 10;
+// Default limit of --cache, in MiB
+constexpr std::size_t cacheSize = 1024;
+
+/* Processes one input: all its objects, or the given ones. Returns
+   nonzero if it couldn't be read; jobs for it may still be pending. */
+int run(const Output& out, const std::string& filename, const std::vector<pdf::ObjRef>& objects,
+    const std::vector<pdf::PageRange>& pages, bool split) {
+  // "-" is stdin, output is then named after the prefix "stdin"
+  const bool useStdin = filename == "-";
+  const std::string prefix = useStdin ? "stdin" : filename;
+  // Pipes, sockets and devices are read as a stream
+  const bool streaming = useStdin
+    || [&filename] { struct stat st; return ::stat(filename.c_str(), &st) == 0 && !S_ISREG(st.st_mode); }();
+  std::unique_ptr<std::streambuf> input{};
+  int fd = -1;
+  if(useStdin)
+    fd = STDIN_FILENO;
+  else if(streaming)
+    fd = ::open(filename.c_str(), O_RDONLY);
+  else
+    input = pdf::openInput(filename);
+  if(streaming ? fd == -1 : !input) {
+    std::cerr << "Can't open " << filename << " for reading.\n";
+    return 1;
+  }
+
+
+  if(!objects.empty() || !pages.empty()) {
+    if(streaming) {
+      std::cerr << "Extracting objects needs a seekable input.\n";
+      return 1;
+    }
+    return objects.empty() ? extract_pages(out, input.get(), prefix, pages) : extract(out, input.get(), prefix, objects);
+  }
+  if(out.latest) {
+    if(streaming) {
+      std::cerr << "Reading the newest revision needs a seekable input.\n";
+      return 1;
+    }
+    return extract_latest(out, input.get(), prefix);
+  }
+
+  // Each object is parsed into the arena, which is rewound before the next one.
+  // Anything kept longer (e.g., streams handed to the pool) is a copy.
+  std::vector<std::byte> arenaBuf(arenaSize);
+  std::pmr::monotonic_buffer_resource arena{arenaBuf.data(), arenaBuf.size()};
+
+  if(streaming) {
+    if(split)
+      std::clog << "Warning: parallel parsing needs -j and a regular file, reading sequentially\n";
+    bool ok = read_stream(out, fd, prefix, arena);
+    if(!useStdin)
+      ::close(fd);
+    return ok ? 0 : 1;
+  }
+
+  std::istream ifs{input.get()};
 
   if(pdf::Version v{}; !(ifs >> v)) {
     std::clog << "Warning: PDF header missing\n";
     ifs.clear();
   }
 
+  if(split) {
+    if(auto* mem = dynamic_cast<pdf::InputBuffer*>(input.get()); mem && out.pool.threads() > 0) {
+      pdf::parser::parseSplit(*mem, mem->offset(mem->cur()), out.pool, splitChunk,
+          [&](pdf::parser::ParsedObject&& po) { process_parsed(out, po, filename); });
+      return 0;
+    }
+    std::clog << "Warning: parallel parsing needs -j and a regular file, reading sequentially\n";
+  }
+
   pdf::TopLevelObject tlo{};
+  std::optional<pdf::parser::RecoveryScan> recovery{};
   while(true) {
-    ifs >> tlo;
+    tlo = {};
+    arena.release();
+    {
+      pdf::ResourceScope scope{&arena};
+      ifs >> tlo;
+    }
     if(ifs.eof())
       break;
-    if(tlo.is<pdf::NamedObject>()) {
-      const auto& nmo = tlo.get<pdf::NamedObject>();
-      std::string basename = [&nmo, &argv]() {
-        std::ostringstream oss{};
-        auto [num, gen] = nmo.numgen();
-        oss << argv[1] << '-' << num << '.' << gen;
-        return oss.str();
-      }();
-      std::string filename = basename + ".obj";
-      std::ofstream ofs{filename};
-      ofs << tlo;
-      std::clog << "Saved: " << filename << (tlo.failed() ? " (errors)\n" : "\n");
-      const auto& obj = nmo.object();
-      if(obj.is<pdf::Stream>()) {
-        if(const auto& val = obj.get<pdf::Stream>().dict().lookup("Type");
-            val.is<pdf::Name>() && val.get<pdf::Name>() == "ObjStm") {
-          unpack_objstm(obj.get<pdf::Stream>(), basename);
-        }
-        else if(decompress) {
-          auto [filename, errors] = save_data(obj.get<pdf::Stream>(), basename);
-          std::clog << "Saved data: " << filename << (errors ? " (errors)\n" : "\n");
-        }
-      }
-      ifs.clear();
-    } else if(tlo.is<pdf::XRefTable>()) {
-      std::clog << "Skipping xref table\n";
-    } else if(tlo.is<pdf::Trailer>()) {
-      const auto& trailer = tlo.get<pdf::Trailer>();
-      std::ostringstream oss{};
-      oss << argv[1] << "-trailer-" << trailer.start() << ".obj";
-      std::ofstream ofs{oss.str()};
-      ofs << trailer;
-      std::clog << "Saving: " << oss.str() << '\n';
-    } else if(tlo.is<pdf::StartXRef>()) {
-      std::clog << "Skipping startxref marker\n";
-    } else if(tlo.is<pdf::Invalid>()) {
-      std::string error = tlo.get<pdf::Invalid>().get_error();
-      assert(!error.empty());
-      std::cerr << "!!! " << error << '\n';
-      ifs.clear();
-      if(ifs >> pdf::skipToEndObj)
-        std::clog << "Skipping past endobj at " << ifs.tellg() << '\n';
+    // Partially parsed objects leave badbit set
+    ifs.clear();
+    if(!tlo.is<pdf::Invalid>())
+      process(out, tlo, filename);
+    else {
+      report_invalid(out, tlo);
+      bool skipped;
+      if(auto* mem = dynamic_cast<pdf::InputBuffer*>(input.get())) {
+        // All candidates in one pass, when first needed
+        if(!recovery)
+          recovery.emplace(mem->data());
+        skipped = recovery->skipToEndObj(*mem);
+      } else
+        skipped = static_cast<bool>(ifs >> pdf::skipToEndObj);
+      if(skipped)
+        std::clog << "Skipping past endobj at " + std::to_string(ifs.tellg()) + '\n';
       else {
         std::clog << "End of file reached seeking enobj\n";
         break;
       }
     }
   }
+  return 0;
+}
+
+/* run() for one input of main, also as a job of batch mode: anything it
+   doesn't handle fails this input only, the others and the summary go on. */
+int run_file(const Output& out, const std::string& filename, const std::vector<pdf::ObjRef>& objects,
+    const std::vector<pdf::PageRange>& pages, bool split) {
+  try {
+    return run(out, filename, objects, pages, split);
+  } catch(std::exception& e) {
+    report_error(out, e.what());
+    return 1;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<pdf::ObjRef> objects{};
+  std::vector<pdf::PageRange> pages{};
+  unsigned jobs = 0;
+  bool split = false;
+  std::string archive{};
+  bool verbatim = false;
+  std::string cacheDir{};
+  std::size_t cacheMB = cacheSize;
+  std::string fileList{};
+  bool stats = false;
+  std::size_t head = 0;
+  bool latest = false;
+  const option longopts[] = {
+    {"jobs", required_argument, nullptr, 'j'},
+    {"object", required_argument, nullptr, 'o'},
+    {"parallel-parse", no_argument, nullptr, 'p'},
+    {"pages", required_argument, nullptr, 'P'},
+    {"latest", no_argument, nullptr, 'L'},
+    {"archive", required_argument, nullptr, 'a'},
+    {"verbatim", no_argument, nullptr, 'v'},
+    {"inflate", required_argument, nullptr, opt_inflate},
+    {"cache", required_argument, nullptr, opt_cache},
+    {"cache-size", required_argument, nullptr, opt_cache_size},
+    {"files-from", required_argument, nullptr, 'T'},
+    {"stats", required_argument, nullptr, opt_stats},
+    {"head", required_argument, nullptr, opt_head},
+    {nullptr, 0, nullptr, 0}
+  };
+  for(int opt; (opt = getopt_long(argc, argv, "j:o:pP:La:vT:", longopts, nullptr)) != -1; ) {
+    switch(opt) {
+      case 'j':
+        if(int len; std::sscanf(optarg, "%u%n", &jobs, &len) != 1 || optarg[len] != '\0') {
+          std::cerr << "Invalid number of jobs: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      case 'o':
+        if(auto ref = parse_objref(optarg))
+          objects.push_back(*ref);
+        else {
+          std::cerr << "Invalid object number: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      case 'p':
+        split = true;
+        break;
+      case 'P':
+        if(auto ranges = pdf::parsePageRanges(optarg))
+          pages.insert(pages.end(), ranges->begin(), ranges->end());
+        else {
+          std::cerr << "Invalid page list: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      case 'L':
+        latest = true;
+        break;
+      case 'a':
+        archive = optarg;
+        break;
+      case 'v':
+        verbatim = true;
+        break;
+      case opt_inflate: {
+        std::string name{optarg};
+        auto backend = name == "zlib" ? pdf::codec::InflateBackend::zlib
+          : name == "libdeflate" ? pdf::codec::InflateBackend::libdeflate
+          : std::optional<pdf::codec::InflateBackend>{};
+        if(!backend || !pdf::codec::hasBackend(*backend)) {
+          std::cerr << "Inflate backend not available: " << optarg << '\n';
+          return 1;
+        }
+        pdf::codec::setInflateBackend(*backend);
+        break;
+      }
+      case 'T':
+        fileList = optarg;
+        break;
+      case opt_cache:
+        cacheDir = optarg;
+        break;
+      case opt_stats:
+        if(std::string_view{optarg} != "json") {
+          std::cerr << "Unknown statistics format: " << optarg << '\n';
+          return 1;
+        }
+        if(!pdf::stats::enabled()) {
+          std::cerr << "Statistics are not compiled in, rebuild with make STATS=1\n";
+          return 1;
+        }
+        stats = true;
+        break;
+      case opt_cache_size:
+        if(int len; optarg[0] == '-' || std::sscanf(optarg, "%zu%n", &cacheMB, &len) != 1 || optarg[len] != '\0'
+              || cacheMB > SIZE_MAX >> 20) {
+          std::cerr << "Invalid cache size: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      case opt_head:
+        // %zu would take "-1" for SIZE_MAX
+        if(int len; optarg[0] == '-' || std::sscanf(optarg, "%zu%n", &head, &len) != 1 || optarg[len] != '\0'
+              || head == 0 || head > maxHead) {
+          std::cerr << "Invalid number of bytes: " << optarg << '\n';
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  std::vector<std::string> names{&argv[optind], &argv[argc]};
+  if(names.empty() == fileList.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+  if(!objects.empty() && !pages.empty()) {
+    std::cerr << "Either objects or pages can be extracted, not both.\n";
+    return 1;
+  }
+  const bool listFromStdin = fileList == "-";
+  std::ifstream listFile{};
+  if(!fileList.empty() && !listFromStdin) {
+    listFile.open(fileList);
+    if(!listFile) {
+      std::cerr << "Can't open " << fileList << " for reading.\n";
+      return 1;
+    }
+  }
+  std::istream& list = listFromStdin ? std::cin : listFile;
+  // Names in a list are read as they're needed, so the list may come from a pipe
+  std::size_t nextName = 0;
+  auto next_input = [&]() -> std::optional<std::string> {
+    if(fileList.empty())
+      return nextName < names.size() ? std::optional{names[nextName++]} : std::nullopt;
+    for(std::string line; std::getline(list, line); )
+      if(!line.empty())
+        return line;
+    return {};
+  };
+  const bool batch = !fileList.empty() || names.size() > 1;
+
+  bool decompress = true; // TODO
+  // Keep a few jobs per thread ready, but not the whole file
+  pdf::WorkerPool pool{jobs, 2 * jobs};
+
+  std::unique_ptr<pdf::OutputSink> sink;
+  try {
+    if(!archive.empty())
+      sink = std::make_unique<pdf::TarSink>(archive);
+    else
+      sink = std::make_unique<pdf::DirectorySink>();
+  } catch(std::system_error&) {
+    std::cerr << "Can't open " << archive << " for writing.\n";
+    return 1;
+  }
+  std::unique_ptr<pdf::ResultCache> cache{};
+  if(!cacheDir.empty()) {
+    try {
+      cache = std::make_unique<pdf::ResultCache>(cacheDir, cacheMB << 20);
+    } catch(std::system_error& e) {
+      std::cerr << "Can't use cache " << cacheDir << ": " << e.code().message() << '\n';
+      return 1;
+    }
+  }
+
+  /* In batch mode with threads, whole files are jobs too, and the jobs of
+     their streams run in the same pool. Splitting a file as well would
+     have jobs waiting for others. */
+  const bool fileJobs = batch && pool.threads() > 0;
+  if(fileJobs && split) {
+    std::clog << "Warning: files are parsed in parallel, -p is ignored\n";
+    split = false;
+  }
+  // Stable addresses for the jobs referring to them
+  std::deque<FileStatus> statuses{};
+  std::deque<Output> outputs{};
+  while(auto name = next_input()) {
+    auto& status = statuses.emplace_back();
+    status.name = *name;
+    const Output& out = outputs.emplace_back(Output{*sink, pool, decompress, verbatim, head, latest, cache.get(), status, batch});
+    if(*name == "-" && listFromStdin) {
+      report_error(out, "stdin is already the file list");
+      status.result = 1;
+    } else if(fileJobs)
+      pool.submit([&out, &objects, &pages, split] {
+        out.status.result = run_file(out, out.status.name, objects, pages, split);
+      });
+    else
+      status.result = run_file(out, *name, objects, pages, split);
+  }
+  bool ok = finish(pool, *sink);
+  if(stats)
+    std::cout << pdf::stats::json();
+
+  if(!batch)
+    return ok && statuses.front().result == 0 ? 0 : 1;
+  std::cerr << "Summary:\n";
+  for(const auto& status : statuses) {
+    ok = ok && status.result == 0;
+    std::cerr << status.name << ": "
+      << (status.result != 0 ? "failed" : status.errors > 0 ? "errors" : "ok")
+      << ", " << status.saved << " saved, " << status.errors << " errors\n";
+  }
+  return ok ? 0 : 1;
 }
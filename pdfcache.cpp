@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pdfcache.h"
+#include "pdfoutput.h"
+
+namespace pdf {
+
+/***** ContentKey *****/
+
+namespace {
+
+// SHA-256 as in FIPS 180-4
+class Sha256 {
+  static constexpr std::uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  std::uint32_t _state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  unsigned char _block[64];
+  std::size_t _blockLen = 0;
+  std::uint64_t _total = 0;
+
+  static std::uint32_t rotr(std::uint32_t x, unsigned n) { return x >> n | x << (32 - n); }
+
+  void compress(const unsigned char* p) {
+    std::uint32_t w[64];
+    for(int i = 0; i < 16; i++)
+      w[i] = std::uint32_t{p[4 * i]} << 24 | std::uint32_t{p[4 * i + 1]} << 16 | std::uint32_t{p[4 * i + 2]} << 8 | p[4 * i + 3];
+    for(int i = 16; i < 64; i++) {
+      std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ w[i - 15] >> 3;
+      std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ w[i - 2] >> 10;
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    std::uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3],
+      e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+    for(int i = 0; i < 64; i++) {
+      std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+  }
+
+  public:
+  void update(const void* data, std::size_t len) {
+    auto p = static_cast<const unsigned char*>(data);
+    _total += len;
+    if(_blockLen > 0) {
+      std::size_t n = std::min(len, sizeof(_block) - _blockLen);
+      std::memcpy(_block + _blockLen, p, n);
+      _blockLen += n;
+      p += n;
+      len -= n;
+      if(_blockLen < sizeof(_block))
+        return;
+      compress(_block);
+      _blockLen = 0;
+    }
+    for(; len >= sizeof(_block); p += sizeof(_block), len -= sizeof(_block))
+      compress(p);
+    std::memcpy(_block, p, len);
+    _blockLen = len;
+  }
+
+  std::array<std::uint8_t, 32> finish() {
+    std::uint64_t bits = _total * 8;
+    unsigned char pad[72] = {0x80};
+    update(pad, (_blockLen < 56 ? 56 : 120) - _blockLen);
+    unsigned char len[8];
+    for(int i = 0; i < 8; i++)
+      len[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+    update(len, 8);
+    std::array<std::uint8_t, 32> ret;
+    for(int i = 0; i < 32; i++)
+      ret[i] = static_cast<std::uint8_t>(_state[i / 4] >> (24 - 8 * (i % 4)));
+    return ret;
+  }
+};
+
+} // anonymous namespace
+
+ContentKey::ContentKey(std::initializer_list<std::string_view> parts) : h{} {
+  Sha256 sha{};
+  for(std::string_view part : parts) {
+    unsigned char len[8];
+    for(int i = 0; i < 8; i++)
+      len[i] = static_cast<unsigned char>(static_cast<std::uint64_t>(part.length()) >> (8 * i));
+    sha.update(len, sizeof(len));
+    sha.update(part.data(), part.length());
+  }
+  h = sha.finish();
+}
+
+std::string ContentKey::str() const {
+  static constexpr char hexDigits[] = "0123456789abcdef";
+  std::string ret(2 * h.size(), '0');
+  for(std::size_t i = 0; i < h.size(); i++) {
+    ret[2 * i] = hexDigits[h[i] >> 4];
+    ret[2 * i + 1] = hexDigits[h[i] & 15];
+  }
+  return ret;
+}
+
+/***** ResultCache *****/
+
+namespace {
+
+bool isHex(std::string_view name) {
+  return !name.empty() && name.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+}
+
+std::optional<ContentKey> parseKey(std::string_view name) {
+  std::array<std::uint8_t, 32> h{};
+  if(name.length() != 2 * h.size() || !isHex(name))
+    return {};
+  auto digit = [](char c) { return c <= '9' ? c - '0' : c - 'a' + 10; };
+  for(std::size_t i = 0; i < h.size(); i++)
+    h[i] = static_cast<std::uint8_t>(digit(name[2 * i]) << 4 | digit(name[2 * i + 1]));
+  return ContentKey{h};
+}
+
+/* What's left behind by others: temporary files of put() whose process
+   has gone ("<key>.tmp<pid>.<n>"), and entries keyed by the 128-bit hash
+   of earlier versions. */
+bool isStale(std::string_view name) {
+  if(name.length() == 32 && isHex(name))
+    return true;
+  auto tmp = name.find(".tmp");
+  if(tmp == std::string_view::npos || !isHex(name.substr(0, tmp)))
+    return false;
+  std::string rest{name.substr(tmp + 4)};
+  long pid;
+  unsigned long counter;
+  int len;
+  if(std::sscanf(rest.c_str(), "%ld.%lu%n", &pid, &counter, &len) != 2 || rest[len] != '\0' || pid <= 0)
+    return false;
+  return pid != ::getpid() && ::kill(static_cast<pid_t>(pid), 0) == -1 && errno == ESRCH;
+}
+
+std::optional<std::string> readFile(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd == -1)
+    return {};
+  std::string ret{};
+  struct stat st;
+  if(::fstat(fd, &st) == 0) {
+    ret.resize(st.st_size);
+    std::size_t done = 0;
+    while(done < ret.length()) {
+      ssize_t len = ::read(fd, ret.data() + done, ret.length() - done);
+      if(len == -1 && errno == EINTR)
+        continue;
+      if(len <= 0)
+        break;
+      done += len;
+    }
+    ::close(fd);
+    if(done == ret.length())
+      return ret;
+  } else
+    ::close(fd);
+  return {};
+}
+
+} // anonymous namespace
+
+ResultCache::ResultCache(const std::string& dir, std::size_t maxSize)
+  : _dir{dir}, _maxSize{maxSize}, _size{0}, _lru{}, _items{}, _tmpCounter{0}
+{
+  if(::mkdir(dir.c_str(), 0777) == -1 && errno != EEXIST)
+    throw std::system_error(errno, std::generic_category(), dir);
+  DIR* d = ::opendir(dir.c_str());
+  if(!d)
+    throw std::system_error(errno, std::generic_category(), dir);
+  struct Found {
+    ContentKey key;
+    std::size_t size;
+    struct timespec mtime;
+  };
+  std::vector<Found> found{};
+  while(const dirent* de = ::readdir(d))
+    if(isStale(de->d_name))
+      ::unlink((_dir + '/' + de->d_name).c_str());
+    else if(auto key = parseKey(de->d_name)) {
+      struct stat st;
+      if(::stat(path(*key).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        found.push_back({*key, static_cast<std::size_t>(st.st_size), st.st_mtim});
+    }
+  ::closedir(d);
+  // Newest first
+  std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) {
+    return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec > b.mtime.tv_sec : a.mtime.tv_nsec > b.mtime.tv_nsec;
+  });
+  for(const auto& f : found) {
+    _lru.push_back(f.key);
+    _items.emplace(f.key, Item{std::prev(_lru.end()), f.size});
+    _size += f.size;
+  }
+  evict();
+}
+
+std::optional<std::string> ResultCache::get(const ContentKey& key) {
+  {
+    std::lock_guard lock{_mutex};
+    auto it = _items.find(key);
+    if(it == _items.end())
+      return {};
+    _lru.splice(_lru.begin(), _lru, it->second.lru);
+  }
+  std::string filename = path(key);
+  auto ret = readFile(filename);
+  if(ret)
+    // Recording the use for later runs
+    ::utimensat(AT_FDCWD, filename.c_str(), nullptr, 0);
+  else {
+    // Removed by another process
+    std::lock_guard lock{_mutex};
+    forget(key);
+  }
+  return ret;
+}
+
+void ResultCache::put(const ContentKey& key, std::string_view contents) {
+  if(contents.length() > _maxSize)
+    return;
+  std::string filename = path(key);
+  std::string tmpname;
+  {
+    std::lock_guard lock{_mutex};
+    tmpname = filename + ".tmp" + std::to_string(::getpid()) + '.' + std::to_string(_tmpCounter++);
+  }
+  // Readers never see a partially written entry
+  DirectorySink{}.write(tmpname, contents);
+  if(::rename(tmpname.c_str(), filename.c_str()) == -1) {
+    int err = errno;
+    ::unlink(tmpname.c_str());
+    throw std::system_error(err, std::generic_category(), filename);
+  }
+  std::lock_guard lock{_mutex};
+  forget(key);
+  _lru.push_front(key);
+  _items.emplace(key, Item{_lru.begin(), contents.length()});
+  _size += contents.length();
+  evict();
+}
+
+std::string ResultCache::path(const ContentKey& key) const {
+  return _dir + '/' + key.str();
+}
+
+void ResultCache::forget(const ContentKey& key) {
+  if(auto it = _items.find(key); it != _items.end()) {
+    _size -= it->second.size;
+    _lru.erase(it->second.lru);
+    _items.erase(it);
+  }
+}
+
+void ResultCache::evict() {
+  while(_size > _maxSize) {
+    ContentKey key = _lru.back();
+    ::unlink(path(key).c_str());
+    forget(key);
+  }
+}
+
+} // namespace pdf
@@ -0,0 +1,81 @@
+#ifndef PDF_CACHE_H
+#define PDF_CACHE_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace pdf {
+
+/* The SHA-256 digest of some byte strings, identifying a result computed
+   from them. The parts are hashed with their lengths, so ("ab", "c") and
+   ("a", "bc") differ. The cache is shared across documents, so the digest
+   is cryptographic: a file can't be crafted to collide with another. */
+struct ContentKey {
+  std::array<std::uint8_t, 32> h;
+
+  ContentKey(std::initializer_list<std::string_view> parts);
+  ContentKey(const std::array<std::uint8_t, 32>& h_) : h(h_) { }
+
+  // 64 hexadecimal digits.
+  std::string str() const;
+
+  bool operator==(const ContentKey& other) const { return h == other.h; }
+};
+
+/* Results kept in a directory across runs, one file per key. The total
+   size is bounded by evicting least recently used entries; the order
+   survives between runs as the files' modification times. Several
+   processes may share the directory, each only sees the entries present
+   when it started and those it created itself. Temporary files left by
+   processes that no longer run, and entries with keys of an older format,
+   are removed on startup. get() and put() may be called from several
+   threads at once. */
+class ResultCache {
+  struct Hash {
+    std::size_t operator()(const ContentKey& key) const {
+      std::size_t ret;
+      std::memcpy(&ret, key.h.data(), sizeof(ret));
+      return ret;
+    }
+  };
+  struct Item {
+    std::list<ContentKey>::iterator lru;
+    std::size_t size;
+  };
+
+  std::string _dir;
+  std::size_t _maxSize;
+  std::size_t _size;
+  // Most recently used first
+  std::list<ContentKey> _lru;
+  std::unordered_map<ContentKey, Item, Hash> _items;
+  unsigned long _tmpCounter;
+  std::mutex _mutex;
+
+  public:
+  // Creates the directory if needed. Throws std::system_error.
+  ResultCache(const std::string& dir, std::size_t maxSize);
+  ResultCache(const ResultCache&) = delete;
+  ResultCache& operator=(const ResultCache&) = delete;
+
+  std::optional<std::string> get(const ContentKey& key);
+  // Stores a result, evicting others to keep within the size. Throws std::system_error.
+  void put(const ContentKey& key, std::string_view contents);
+
+  private:
+  std::string path(const ContentKey& key) const;
+  void forget(const ContentKey& key);
+  void evict();
+};
+
+} // namespace pdf
+
+#endif
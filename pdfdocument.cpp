@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <set>
+#include <sstream>
+
+#include "pdfdocument.h"
+#include "pdfparser.h"
+#include "pdffilter.h"
+#include "pdfobjstream.h"
+#include "pdfrecover.h"
+
+namespace pdf {
+
+namespace {
+
+std::optional<unsigned long> parseDigits(std::string_view str) {
+  if(str.empty())
+    return {};
+  unsigned long ret = 0;
+  for(char c : str) {
+    if(c < '0' || c > '9')
+      return {};
+    ret = ret * 10 + (c - '0');
+  }
+  return ret;
+}
+
+/* Object numbers are bounded by /Size of the trailer or xref stream that
+   lists them, and by the implementation limit of PDF 1.7 (Annex C), so
+   that numbers in a damaged file can't make the index huge. */
+constexpr unsigned long maxObjects = 8388608;
+
+unsigned long sizeLimit(const Dictionary& dict) {
+  if(const auto& size = dict.lookup(names::Size); size.is<Numeric>() && size.get<Numeric>().uintegral())
+    return std::min(size.get<Numeric>().val_ulong(), maxObjects);
+  return maxObjects;
+}
+
+std::string format_error(const std::string& what, std::streamoff offset) {
+  std::ostringstream oss{};
+  oss << what << " at " << offset;
+  return oss.str();
+}
+
+} // anonymous namespace
+
+Document::Document(std::streambuf* input_)
+  : _input{input_}, _index{}, _trailer{}, _cache{}, _objstms{}, _reading{}, _xrefError{} {
+  try {
+    readXRefChain(findStartXRef());
+  } catch(document_error& e) {
+    auto* mem = dynamic_cast<InputBuffer*>(_input);
+    if(!mem)
+      throw;
+    _xrefError = e.what();
+    reconstruct(*mem);
+  }
+}
+
+Document::~Document() = default;
+
+std::streamoff Document::findStartXRef() {
+  // The spec requires startxref to be within the last 1024 bytes
+  constexpr std::streamoff tailSize = 1024;
+  std::streamoff size = _input->pubseekoff(0, std::ios_base::end, std::ios_base::in);
+  if(size == -1)
+    throw document_error("Input is not seekable");
+  std::streamoff start = std::max<std::streamoff>(0, size - tailSize);
+  _input->pubseekpos(start, std::ios_base::in);
+  std::string tail(size - start, '\0');
+  tail.resize(_input->sgetn(tail.data(), tail.length()));
+  auto off = tail.rfind("startxref");
+  if(off == std::string::npos)
+    throw document_error("startxref not found");
+  _input->pubseekpos(start + off, std::ios_base::in);
+  parser::TokenParser ts{_input};
+  TopLevelObject tlo = parser::readTopLevelObject(ts);
+  if(!tlo.is<StartXRef>())
+    throw document_error(format_error("Broken startxref", start + off));
+  return tlo.get<StartXRef>().offset();
+}
+
+void Document::readXRefChain(std::streamoff offset) {
+  std::set<std::streamoff> visited{};
+  // Newest first: entries already set are never overwritten by older sections
+  while(visited.insert(offset).second) {
+    Dictionary dict = readXRef(offset, visited);
+    const auto& prev = dict.lookup(names::Prev);
+    bool more = prev.is<Numeric>() && prev.get<Numeric>().uintegral();
+    if(more)
+      offset = prev.get<Numeric>().val_ulong();
+    if(!_trailer)
+      _trailer = {std::move(dict)};
+    if(!more)
+      break;
+  }
+}
+
+Dictionary Document::readXRef(std::streamoff offset, std::set<std::streamoff>& visited) {
+  _input->pubseekpos(offset, std::ios_base::in);
+  parser::TokenParser ts{_input};
+  TopLevelObject xref = parser::readTopLevelObject(ts);
+  if(xref.is<Invalid>())
+    throw document_error(xref.get<Invalid>().get_error());
+  else if(xref.is<XRefTable>()) {
+    TopLevelObject trailer = parser::readTopLevelObject(ts);
+    if(!trailer.is<Trailer>() || !trailer.get<Trailer>().dict().is<Dictionary>())
+      throw document_error(format_error("Broken trailer after xref table", offset));
+    const auto& dict = trailer.get<Trailer>().dict().get<Dictionary>();
+    // Hybrid file: the stream lists objects hidden from older readers, so it goes first
+    if(const auto& stm = dict.lookup(names::XRefStm); stm.is<Numeric>() && stm.get<Numeric>().uintegral()
+        && visited.insert(stm.get<Numeric>().val_ulong()).second)
+      readXRef(stm.get<Numeric>().val_ulong(), visited);
+    for(const auto& section : xref.get<XRefTable>().table())
+      addSection(section, sizeLimit(dict));
+    return dict;
+  } else if(xref.is<NamedObject>() && xref.get<NamedObject>().object().is<Stream>()) {
+    const auto& stm = xref.get<NamedObject>().object().get<Stream>();
+    if(const auto& type = stm.dict().lookup(names::Type); !type.is<Name>() || !(type.get<Name>() == names::XRef))
+      throw document_error(format_error("Object is not an xref stream", offset));
+    addStream(stm);
+    return stm.dict();
+  } else
+    throw document_error(format_error("xref table not found", offset));
+}
+
+void Document::addSection(const XRefTable::Section& section, unsigned long size) {
+  // Each row is "nnnnnnnnnn ggggg n" plus a two-character EOL
+  constexpr std::size_t rowLen = 20;
+  std::string_view data{section.data};
+  if(section.start >= size)
+    return;
+  unsigned long count = std::min(section.count, size - section.start);
+  for(unsigned long i = 0; i < count && (i + 1) * rowLen <= data.length(); i++) {
+    std::string_view row = data.substr(i * rowLen, rowLen);
+    auto offset = parseDigits(row.substr(0, 10));
+    auto gen = parseDigits(row.substr(11, 5));
+    if(!offset || !gen)
+      continue;
+    if(row[17] == 'n')
+      setEntry(section.start + i, {Entry::Type::used, static_cast<std::streamoff>(*offset), *gen});
+    else if(row[17] == 'f')
+      setEntry(section.start + i, {Entry::Type::free, 0, *gen});
+  }
+}
+
+void Document::addStream(const Stream& stm) {
+  std::string data{};
+  try {
+    DecoderChain dc{stm};
+    if(!dc.complete())
+      throw document_error("Can't decode xref stream (" + dc.last() + ")");
+    std::array<char, 4096> buf;
+    while(auto len = dc.rdbuf()->sgetn(buf.data(), buf.size()))
+      data.append(buf.data(), len);
+  } catch(codec::decode_error& e) {
+    throw document_error(std::string{"xref stream: "} + e.what());
+  }
+
+  const auto& oW = stm.dict().lookup(names::W);
+  if(!oW.is<Array>() || oW.get<Array>().items().size() != 3)
+    throw document_error("Invalid /W in xref stream");
+  std::array<std::size_t, 3> w;
+  for(int i = 0; i < 3; i++) {
+    const auto& item = oW.get<Array>().items()[i];
+    if(!item.is<Numeric>() || !item.get<Numeric>().uintegral() || item.get<Numeric>().val_ulong() > 8)
+      throw document_error("Invalid /W in xref stream");
+    w[i] = item.get<Numeric>().val_ulong();
+  }
+  const std::size_t rowLen = w[0] + w[1] + w[2];
+  if(rowLen == 0)
+    throw document_error("Invalid /W in xref stream");
+
+  std::vector<unsigned long> index{};
+  if(const auto& oIndex = stm.dict().lookup(names::Index); oIndex.is<Array>()) {
+    for(const auto& item : oIndex.get<Array>().items()) {
+      if(!item.is<Numeric>() || !item.get<Numeric>().uintegral())
+        throw document_error("Invalid /Index in xref stream");
+      index.push_back(item.get<Numeric>().val_ulong());
+    }
+    if(index.size() % 2 != 0)
+      throw document_error("Invalid /Index in xref stream");
+  } else if(const auto& oSize = stm.dict().lookup(names::Size); oSize.is<Numeric>() && oSize.get<Numeric>().uintegral())
+    index = {0, oSize.get<Numeric>().val_ulong()};
+  else
+    throw document_error("Xref stream lacks /Size");
+
+  const auto* ptr = reinterpret_cast<const unsigned char*>(data.data());
+  const auto* end = ptr + data.length();
+  auto field = [&ptr](std::size_t width, unsigned long dflt) {
+    if(width == 0)
+      return dflt;
+    unsigned long ret = 0;
+    for(std::size_t i = 0; i < width; i++)
+      ret = (ret << 8) | *ptr++;
+    return ret;
+  };
+  const unsigned long size = sizeLimit(stm.dict());
+  for(std::size_t i = 0; i < index.size(); i += 2)
+    for(unsigned long n = 0; n < index[i + 1]; n++) {
+      if(end - ptr < static_cast<std::ptrdiff_t>(rowLen))
+        throw document_error("Xref stream data too short");
+      auto type = field(w[0], 1);
+      auto f2 = field(w[1], 0);
+      auto f3 = field(w[2], 0);
+      // Rows past /Size are read but not used
+      if(index[i] >= size || n >= size - index[i])
+        continue;
+      unsigned long num = index[i] + n;
+      if(type == 0)
+        setEntry(num, {Entry::Type::free, 0, f3});
+      else if(type == 1)
+        setEntry(num, {Entry::Type::used, static_cast<std::streamoff>(f2), f3});
+      else if(type == 2)
+        setEntry(num, {Entry::Type::compressed, static_cast<std::streamoff>(f2), f3});
+      // Other types are to be ignored per spec
+    }
+}
+
+void Document::setEntry(unsigned long num, Entry entry) {
+  if(num >= maxObjects)
+    return;
+  if(num >= _index.size())
+    _index.resize(num + 1, {Entry::Type::none, 0, 0});
+  if(_index[num].type == Entry::Type::none)
+    _index[num] = entry;
+}
+
+const Document::Entry& Document::entry(unsigned long num) const {
+  static const Entry none{Entry::Type::none, 0, 0};
+  return num < _index.size() ? _index[num] : none;
+}
+
+const TopLevelObject& Document::load(ObjRef ref) {
+  if(auto it = _cache.find(ref); it != _cache.end())
+    return it->second;
+  return _cache.emplace(ref, read(ref)).first->second;
+}
+
+TopLevelObject Document::read(ObjRef ref) {
+  if(auto it = _cache.find(ref); it != _cache.end())
+    return it->second;
+  if(!_reading.insert(ref).second) {
+    std::ostringstream oss{};
+    oss << "Object " << ref.num << ' ' << ref.gen << " is in an object stream contained in itself";
+    return {Invalid{oss.str()}};
+  }
+  struct Done {
+    std::set<ObjRef>& reading;
+    ObjRef ref;
+    ~Done() { reading.erase(ref); }
+  } done{_reading, ref};
+  TopLevelObject tlo{};
+  if(const Entry& e = entry(ref.num); e.type == Entry::Type::used && e.gen == ref.gen) {
+    tlo = readAt(e.offset);
+    if(!tlo.is<NamedObject>() || tlo.get<NamedObject>().numgen() != std::pair{ref.num, ref.gen}) {
+      std::ostringstream oss{};
+      oss << "Object " << ref.num << ' ' << ref.gen << " not found at " << e.offset;
+      tlo = {Invalid{oss.str()}};
+    }
+  } else if(e.type == Entry::Type::compressed && ref.gen == 0)
+    tlo = loadCompressed(ref, e);
+  return tlo;
+}
+
+void Document::releaseObjStream(unsigned long num) {
+  _objstms.erase(num);
+}
+
+void Document::reconstruct(const InputBuffer& input) {
+  using Kind = parser::RecoveryScan::Kind;
+  _index.clear();
+  _trailer = {};
+  _cache.clear();
+  _objstms.clear();
+  parser::RecoveryScan scan{input.data()};
+  const char* begin = input.data().data();
+  const char* end = begin + input.data().length();
+  // Scan offsets are from the start of the data
+  const std::streamoff base = input.offset(begin);
+  // Later definitions are newer
+  for(const auto& cand : scan.all(Kind::object)) {
+    if(cand.num >= maxObjects)
+      continue;
+    if(cand.num >= _index.size())
+      _index.resize(cand.num + 1, {Entry::Type::none, 0, 0});
+    _index[cand.num] = {Entry::Type::used, base + cand.offset, cand.gen};
+  }
+  if(_index.empty())
+    throw document_error(_xrefError + ", and no objects found to rebuild it");
+  /* Only objects with these in their dictionary need to be looked at:
+     object streams, and the newest xref stream in lack of a trailer */
+  const auto& objects = scan.all(Kind::object);
+  auto containing = [&](const char* ptr) -> const parser::RecoveryScan::Candidate* {
+    auto it = std::upper_bound(objects.begin(), objects.end(), ptr - begin,
+        [](std::streamoff off, const auto& cand) { return off < cand.offset; });
+    return it == objects.begin() ? nullptr : &*std::prev(it);
+  };
+  auto typed = [&](std::string_view type, auto action) {
+    for(const char* ptr = parser::findKeyword(begin, end, type); ptr != end;
+        ptr = parser::findKeyword(ptr + 1, end, type)) {
+      if(const char* after = ptr + type.length();
+          after != end && parser::charType(*after) == parser::CharType::regular)
+        continue;
+      const auto* cand = containing(ptr);
+      // Only if it's the definition in use
+      if(!cand || cand->gen != 0 || cand->num >= _index.size() || _index[cand->num].offset != base + cand->offset)
+        continue;
+      const auto& tlo = load({cand->num, 0});
+      if(!tlo.is<NamedObject>() || !tlo.get<NamedObject>().object().is<Stream>())
+        continue;
+      const auto& stm = tlo.get<NamedObject>().object().get<Stream>();
+      if(const auto& oType = stm.dict().lookup(names::Type); oType.is<Name>() && oType.get<Name>() == type.substr(1))
+        action(cand->num, stm);
+    }
+  };
+  std::vector<unsigned long> objstms{};
+  typed("/ObjStm", [&](unsigned long num, const Stream&) { objstms.push_back(num); });
+  typed("/XRef", [&](unsigned long, const Stream& stm) { _trailer = {Dictionary{stm.dict()}}; });
+  for(unsigned long num : objstms) {
+    try {
+      parser::ObjStream objstm{load({num, 0}).get<NamedObject>().object().get<Stream>()};
+      for(std::size_t ix = 0; ix < objstm.size(); ix++) {
+        unsigned long inner = objstm.number(ix);
+        if(inner >= maxObjects)
+          continue;
+        if(inner >= _index.size())
+          _index.resize(inner + 1, {Entry::Type::none, 0, 0});
+        if(_index[inner].type == Entry::Type::none)
+          _index[inner] = {Entry::Type::compressed, static_cast<std::streamoff>(num), ix};
+      }
+    } catch(parser::objstm_error&) {
+      // Skip broken ones
+    } catch(codec::decode_error&) {
+      // Same
+    }
+  }
+  // The last trailer that parses
+  const auto& trailers = scan.all(Kind::trailer);
+  for(auto it = trailers.rbegin(); it != trailers.rend(); ++it) {
+    TopLevelObject tlo = readAt(base + it->offset);
+    if(tlo.is<Trailer>() && tlo.get<Trailer>().dict().is<Dictionary>()) {
+      _trailer = tlo.get<Trailer>().dict();
+      break;
+    }
+  }
+}
+
+TopLevelObject Document::readAt(std::streamoff offset) {
+  _input->pubseekpos(offset, std::ios_base::in);
+  parser::TokenParser ts{_input};
+  return parser::readTopLevelObject(ts);
+}
+
+TopLevelObject Document::loadCompressed(ObjRef ref, const Entry& e) {
+  std::ostringstream oss{};
+  oss << "Object " << ref.num << " not found in object stream " << e.offset;
+  const auto& container = load({static_cast<unsigned long>(e.offset), 0});
+  if(!container.is<NamedObject>() || !container.get<NamedObject>().object().is<Stream>())
+    return {Invalid{oss.str()}};
+  try {
+    auto& objstm = _objstms[e.offset];
+    if(!objstm)
+      objstm = std::make_unique<parser::ObjStream>(container.get<NamedObject>().object().get<Stream>());
+    TopLevelObject tlo = objstm->read(e.gen);
+    if(!tlo.is<NamedObject>() || tlo.get<NamedObject>().numgen().first != ref.num)
+      // Index in xref doesn't match, look up by number instead
+      tlo = objstm->find(ref.num);
+    if(!tlo)
+      return {Invalid{oss.str()}};
+    return tlo;
+  } catch(parser::objstm_error& err) {
+    return {Invalid{oss.str() + ": " + err.what()}};
+  } catch(codec::decode_error& err) {
+    return {Invalid{oss.str() + ": " + err.what()}};
+  }
+}
+
+} // namespace pdf
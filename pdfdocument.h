@@ -0,0 +1,92 @@
+#ifndef PDF_DOCUMENT_H
+#define PDF_DOCUMENT_H
+
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <streambuf>
+#include <vector>
+
+#include "pdfbase.h"
+#include "pdffile.h"
+#include "pdfinput.h"
+
+namespace pdf {
+
+namespace parser {
+  class ObjStream;
+}
+
+struct document_error : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/* Random access to the objects of a PDF file through its cross-reference
+   tables or streams, without a full pass over the file. The input must be
+   seekable. The constructor locates startxref and reads the xref chain
+   following /Prev and /XRefStm; objects are parsed on demand and cached.
+   If that fails and the input is in memory, the xref is reconstructed from
+   a RecoveryScan of the whole file instead. */
+class Document {
+  public:
+  struct Entry {
+    enum class Type {
+      none, // not listed in any xref section
+      free,
+      used,
+      compressed // stored in an object stream
+    };
+    Type type;
+    std::streamoff offset; // compressed: number of the object stream
+    unsigned long gen;     // compressed: index within the object stream
+  };
+
+  private:
+  std::streambuf* _input;
+  std::vector<Entry> _index;
+  Object _trailer;
+  std::map<ObjRef, TopLevelObject> _cache;
+  // Decoded object streams, by object number
+  std::map<unsigned long, std::unique_ptr<parser::ObjStream>> _objstms;
+  // Objects being read, an object stream can't be loaded from within itself
+  std::set<ObjRef> _reading;
+  std::string _xrefError;
+
+  public:
+  Document(std::streambuf* input_);
+  ~Document();
+
+  // Dictionary of the most recent trailer.
+  const Object& trailer() const { return _trailer; }
+  // If the xref was reconstructed, the error that prevented reading it.
+  const std::string& xrefError() const { return _xrefError; }
+
+  // Object numbers 0 to size()-1 may have an entry.
+  std::size_t size() const { return _index.size(); }
+  const Entry& entry(unsigned long num) const;
+
+  // Returns a NamedObject, Null if there's no such object, or Invalid.
+  const TopLevelObject& load(ObjRef ref);
+  /* Same as load(), but the result isn't kept, for reading every object
+     once. Objects already loaded are returned as copies. */
+  TopLevelObject read(ObjRef ref);
+  // Frees the decoded contents of an object stream, if it was needed.
+  void releaseObjStream(unsigned long num);
+
+  private:
+  std::streamoff findStartXRef();
+  void readXRefChain(std::streamoff offset);
+  // visited: offsets of xref sections read so far, to break cycles
+  Dictionary readXRef(std::streamoff offset, std::set<std::streamoff>& visited);
+  void addSection(const XRefTable::Section& section, unsigned long size);
+  void addStream(const Stream& stm);
+  void setEntry(unsigned long num, Entry entry);
+  void reconstruct(const InputBuffer& input);
+  TopLevelObject readAt(std::streamoff offset);
+  TopLevelObject loadCompressed(ObjRef ref, const Entry& e);
+};
+
+} // namespace pdf
+
+#endif
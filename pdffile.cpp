@@ -5,30 +5,47 @@
 
 namespace pdf {
 
-void NamedObject::dump(std::ostream& os, unsigned) const {
-  os << num << ' ' << gen << " obj\n";
-  contents.dump(os, 1);
-  os << '\n';
-  if(!error.empty())
-    os << "% !!! " + error + '\n';
-  os << "endobj\n";
+void NamedObject::dump(Writer& w, unsigned) const {
+  if(w.verbatim() && !_source.empty() && !failed()) {
+    w.putData(_source);
+    w.put('\n');
+    return;
+  }
+  w.put(num);
+  w.put(' ');
+  w.put(gen);
+  w.put(" obj\n");
+  contents.dump(w, 1);
+  w.put('\n');
+  if(!error.empty()) {
+    w.put("% !!! ");
+    w.put(error);
+    w.put('\n');
+  }
+  w.put("endobj\n");
 }
 
-void XRefTable::dump(std::ostream& os, unsigned) const {
-  os << "xref\n";
-  for(const auto& section : _table)
-    os << section.start << ' ' << section.count << '\n'
-      << section.data /* << '\n' already in data */;
+void XRefTable::dump(Writer& w, unsigned) const {
+  w.put("xref\n");
+  for(const auto& section : _table) {
+    w.put(section.start);
+    w.put(' ');
+    w.put(section.count);
+    w.put('\n');
+    w.put(section.data); // '\n' already in data
+  }
 }
 
-void Trailer::dump(std::ostream& os, unsigned) const {
-  os << "trailer\n";
-  _dict.dump(os, 1);
-  os << '\n';
+void Trailer::dump(Writer& w, unsigned) const {
+  w.put("trailer\n");
+  _dict.dump(w, 1);
+  w.put('\n');
 }
 
-void StartXRef::dump(std::ostream& os, unsigned) const {
-  os << "startxref\n" << val << "\n%%EOF\n";
+void StartXRef::dump(Writer& w, unsigned) const {
+  w.put("startxref\n");
+  w.put(static_cast<long>(val));
+  w.put("\n%%EOF\n");
 }
 
 /***** iostream interface *****/
@@ -2,6 +2,7 @@
 #define PDF_FILE_H
 
 #include <istream>
+#include <memory>
 
 #include "pdfbase.h"
 
@@ -12,24 +13,38 @@ struct Version {
   unsigned minor;
 };
 
+/* May remember the bytes it was parsed from, from "n g obj" to "endobj",
+   if they stay in memory (e.g., a memory-mapped file). A Writer in
+   verbatim mode copies them instead of serializing the object. */
 class NamedObject : public internal::ObjBase {
   unsigned long num;
   unsigned long gen;
   Object contents;
   std::string error;
+  std::string_view _source;
+  std::shared_ptr<const void> _owner; // keeps the memory _source refers to alive
 
   public:
   template<typename T>
   NamedObject(unsigned long num_, unsigned long gen_, Object&& contents_, T&& err_)
-    : num(num_), gen(gen_), contents(std::move(contents_)), error(std::forward<T>(err_)) { }
+    : num(num_), gen(gen_), contents(std::move(contents_)), error(std::forward<T>(err_)),
+      _source(), _owner() { }
   NamedObject(unsigned long num_, unsigned long gen_, Object&& contents_)
     : NamedObject(num_, gen_, std::move(contents_), "") { }
+  NamedObject(unsigned long num_, unsigned long gen_, Object&& contents_,
+      std::string_view source_, std::shared_ptr<const void> owner_)
+    : num(num_), gen(gen_), contents(std::move(contents_)), error(),
+      _source(source_), _owner(std::move(owner_)) { }
 
   std::pair<unsigned long, unsigned long> numgen() const { return {num, gen}; }
   const Object& object() const { return contents; }
+  // Empty if not known
+  std::string_view source() const { return _source; }
+  // Keeps the memory of source() alive, may be null if that's an arena
+  const std::shared_ptr<const void>& owner() const { return _owner; }
 
-  bool failed() const override { return contents.failed() || !error.empty(); }
-  void dump(std::ostream& os, unsigned off) const override;
+  bool failed() const { return contents.failed() || !error.empty(); }
+  void dump(Writer& w, unsigned off) const;
 };
 
 class XRefTable : public internal::ObjBase {
@@ -47,7 +62,9 @@ private:
   XRefTable(std::vector<Section>&& table_)
     : _table(std::move(table_)) { }
 
-  void dump(std::ostream& os, unsigned off) const override;
+  const std::vector<Section>& table() const { return _table; }
+
+  void dump(Writer& w, unsigned off) const;
 };
 
 class Trailer : public internal::ObjBase {
@@ -61,8 +78,8 @@ public:
   const Object& dict() const { return _dict; }
   std::streamoff start() const { return _start; }
 
-  bool failed() const override { return _dict.failed(); }
-  void dump(std::ostream& os, unsigned off) const override;
+  bool failed() const { return _dict.failed(); }
+  void dump(Writer& w, unsigned off) const;
 };
 
 class StartXRef : public internal::ObjBase {
@@ -71,7 +88,9 @@ class StartXRef : public internal::ObjBase {
   public:
   StartXRef(std::streamoff val_) : val(val_) { }
 
-  void dump(std::ostream& os, unsigned off) const override;
+  std::streamoff offset() const { return val; }
+
+  void dump(Writer& w, unsigned off) const;
 };
 
 using _TopLevelObject = internal::tagged_union<
@@ -1,9 +1,19 @@
 #include <sstream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
 #include <cassert>
+#include <limits>
+#include <atomic>
 #include <zlib.h>
+#ifdef PDF_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 
 #include "pdffilter.h"
+#include "pdfstats.h"
+#include "pdfinput.h"
+#include "pdfscan.h"
 
 namespace pdf {
 
@@ -19,6 +29,36 @@ std::string decode_error::format(std::string_view component, std::string_view er
   return oss.str();
 }
 
+namespace {
+
+std::atomic<InflateBackend> backend{
+#ifdef PDF_USE_LIBDEFLATE
+  InflateBackend::libdeflate
+#else
+  InflateBackend::zlib
+#endif
+};
+
+} // anonymous namespace
+
+bool hasBackend(InflateBackend backend) {
+#ifdef PDF_USE_LIBDEFLATE
+  constexpr bool libdeflate = true;
+#else
+  constexpr bool libdeflate = false;
+#endif
+  return backend != InflateBackend::libdeflate || libdeflate;
+}
+
+void setInflateBackend(InflateBackend backend_) {
+  if(hasBackend(backend_))
+    backend = backend_;
+}
+
+InflateBackend inflateBackend() {
+  return backend;
+}
+
 namespace internal {
 
 // Inspired by https://github.com/mateidavid/zstr
@@ -28,13 +68,14 @@ class ZStream {
   z_stream _stream;
 
   public:
-  ZStream() {
+  // level only applies to compression
+  ZStream(int level = Z_DEFAULT_COMPRESSION) {
     _stream.zalloc = Z_NULL;
     _stream.zfree = Z_NULL;
     _stream.opaque = NULL;
     int ret;
     if constexpr(dir == direction::compress)
-      ret = ::deflateInit(&_stream, Z_DEFAULT_COMPRESSION);
+      ret = ::deflateInit(&_stream, level);
     else
       ret = ::inflateInit(&_stream);
     if(ret != Z_OK) {
@@ -57,70 +98,646 @@ class ZStream {
 
 } // namespace pdf::codec::internal
 
-DeflateDecoder::DeflateDecoder(std::streambuf* in_sbuf_)
-  : in_sbuf(in_sbuf_),
-    stream(std::make_unique<decltype(stream)::element_type>())
+DeflateDecoder::DeflateDecoder(std::streambuf* in_sbuf_, std::size_t bufSize_, bool whole_)
+  : bufSize(std::max<std::size_t>(bufSize_, 1)),
+    in_sbuf(in_sbuf_),
+    in_mem(dynamic_cast<InputBuffer*>(in_sbuf_)),
+    stream(std::make_unique<decltype(stream)::element_type>()),
+    inBuffer(in_mem ? 0 : bufSize), outBuffer(bufSize),
+    tryWhole(whole_ && in_mem && inflateBackend() == InflateBackend::libdeflate),
+    finished(false)
 {
   stream->get().avail_in = 0;
-  setg(&outBuffer[0], &outBuffer[0], &outBuffer[0]);
+  setg(outBuffer.data(), outBuffer.data(), outBuffer.data());
 }
 
-DeflateDecoder::~DeflateDecoder() { }
+DeflateDecoder::~DeflateDecoder() {
+  // Everything zlib went through; inflateWhole() counts on its own
+  stats::add(stats::Counter::inflateIn, stream->get().total_in);
+  stats::add(stats::Counter::inflateOut, stream->get().total_out);
+}
 
-std::streambuf::int_type DeflateDecoder::underflow() {
+// Returns false if the caller should continue with zlib.
+bool DeflateDecoder::inflateWhole() {
+#ifdef PDF_USE_LIBDEFLATE
+  stats::ScopedTimer timer{stats::Timer::inflate};
+  // Larger outputs are better streamed than kept in memory
+  constexpr std::size_t maxSize = 64 << 20;
+  struct Deleter {
+    void operator()(libdeflate_decompressor* d) { libdeflate_free_decompressor(d); }
+  };
+  thread_local std::unique_ptr<libdeflate_decompressor, Deleter> decompressor{libdeflate_alloc_decompressor()};
+  if(!decompressor)
+    return false;
+  std::string_view in = in_mem->remaining();
+  std::vector<char_type> out(std::min(maxSize, std::max(bufSize, 4 * in.length())));
+  while(true) {
+    std::size_t inLen, outLen;
+    auto ret = libdeflate_zlib_decompress_ex(decompressor.get(), in.data(), in.length(),
+        out.data(), out.size(), &inLen, &outLen);
+    if(ret == LIBDEFLATE_SUCCESS) {
+      stats::add(stats::Counter::inflateIn, inLen);
+      stats::add(stats::Counter::inflateOut, outLen);
+      in_mem->seek(in_mem->cur() + inLen);
+      out.resize(outLen);
+      outBuffer = std::move(out);
+      setg(outBuffer.data(), outBuffer.data(), outBuffer.data() + outBuffer.size());
+      return true;
+    } else if(ret == LIBDEFLATE_INSUFFICIENT_SPACE && out.size() < maxSize)
+      out.resize(std::min(maxSize, 2 * out.size()));
+    else
+      return false;
+  }
+#else
+  return false;
+#endif
+}
+
+bool DeflateDecoder::fill() {
   auto& zstr = stream->get();
-  zstr.next_out = reinterpret_cast<Bytef*>(&outBuffer[0]);
-  zstr.avail_out = bufSize;
-  std::streamsize readBytes;
+  if(in_mem) {
+    // Hand all of the remaining input to zlib at once (as far as uInt goes)
+    std::size_t len = std::min<std::size_t>(in_mem->remaining().length(), std::numeric_limits<uInt>::max());
+    zstr.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in_mem->cur()));
+    zstr.avail_in = len;
+    in_mem->seek(in_mem->cur() + len);
+  } else {
+    zstr.next_in = reinterpret_cast<Bytef*>(inBuffer.data());
+    zstr.avail_in = in_sbuf->sgetn(inBuffer.data(), bufSize);
+  }
+  return zstr.avail_in != 0;
+}
+
+// Returns the number of bytes written to out, 0 at the end of data.
+std::size_t DeflateDecoder::inflate(char_type* out, std::size_t len) {
+  stats::ScopedTimer timer{stats::Timer::inflate};
+  auto& zstr = stream->get();
+  zstr.next_out = reinterpret_cast<Bytef*>(out);
+  zstr.avail_out = std::min<std::size_t>(len, std::numeric_limits<uInt>::max());
+  const std::size_t avail = zstr.avail_out;
   while(true) {
-    if(zstr.avail_in == 0) {
-      zstr.next_in = reinterpret_cast<Bytef*>(&inBuffer[0]);
-      zstr.avail_in = in_sbuf->sgetn(&inBuffer[0], bufSize);
-      if(zstr.avail_in == 0)
-        return traits_type::eof();
-    }
+    if(zstr.avail_in == 0 && !fill())
+      return 0;
     int ret = ::inflate(&zstr, Z_NO_FLUSH);
     if(ret != Z_OK && ret != Z_STREAM_END)
       ret = ::inflate(&zstr, Z_SYNC_FLUSH);
-    readBytes = bufSize - zstr.avail_out;
-    if(readBytes != 0)
+    if(std::size_t readBytes = avail - zstr.avail_out; readBytes != 0)
+      return readBytes;
+    else if(ret == Z_STREAM_END)
+      return 0;
+    else if(ret != Z_OK) {
+      assert(zstr.msg != NULL);
+      std::streamoff pos = static_cast<std::streamoff>(
+          in_sbuf->pubseekoff(0, std::ios::cur, std::ios::in))
+        - zstr.avail_in;
+      throw decode_error("zlib", zstr.msg, pos);
+    }
+  }
+}
+
+std::streambuf::int_type DeflateDecoder::underflow() {
+  if(finished)
+    return traits_type::eof();
+  if(tryWhole) {
+    tryWhole = false;
+    if(inflateWhole()) {
+      finished = true;
+      return outBuffer.empty() ? traits_type::eof() : traits_type::to_int_type(outBuffer[0]);
+    }
+  }
+  std::size_t readBytes = inflate(outBuffer.data(), bufSize);
+  setg(outBuffer.data(), outBuffer.data(), outBuffer.data() + readBytes);
+  return readBytes > 0 ? traits_type::to_int_type(outBuffer[0]) : traits_type::eof();
+}
+
+std::streamsize DeflateDecoder::xsgetn(char_type* s, std::streamsize count) {
+  std::streamsize total = 0;
+  while(total < count) {
+    if(gptr() != egptr()) {
+      std::streamsize len = std::min<std::streamsize>(count - total, egptr() - gptr());
+      std::copy(gptr(), gptr() + len, s + total);
+      gbump(static_cast<int>(len));
+      total += len;
+    } else if(!tryWhole && !finished && static_cast<std::size_t>(count - total) >= bufSize) {
+      // Large reads skip the output buffer
+      std::size_t len = inflate(s + total, count - total);
+      if(len == 0)
+        break;
+      total += len;
+    } else if(traits_type::eq_int_type(underflow(), traits_type::eof()))
       break;
-    else {
-      if(ret == Z_STREAM_END)
-        return traits_type::eof();
-      else if(ret == Z_OK)
-        continue;
+  }
+  return total;
+}
+
+namespace {
+
+// Far beyond the rows of any real image
+constexpr std::size_t maxRowBytes = 16 << 20;
+
+// Checked before the row buffers are sized from it
+std::size_t predictorRowBytes(unsigned colors, unsigned bpc, unsigned columns) {
+  if(colors == 0 || columns == 0)
+    throw decode_error("Predictor", "Invalid /Colors or /Columns", -1);
+  if(bpc != 1 && bpc != 2 && bpc != 4 && bpc != 8 && bpc != 16)
+    throw decode_error("Predictor", "Unsupported /BitsPerComponent", -1);
+  // Both factors fit in 32 bits, so their product can't overflow
+  std::size_t pixelBits = static_cast<std::size_t>(colors) * bpc;
+  if(pixelBits > maxRowBytes * 8 / columns)
+    throw decode_error("Predictor", "Row too long", -1);
+  return (pixelBits * columns + 7) / 8;
+}
+
+} // anonymous namespace
+
+PredictorDecoder::PredictorDecoder(std::streambuf* in_sbuf_, unsigned predictor, unsigned colors_, unsigned bpc_, unsigned columns)
+  : in_sbuf(in_sbuf_),
+    png(predictor >= 10),
+    colors(colors_), bpc(bpc_),
+    samples(static_cast<std::size_t>(colors) * columns),
+    rowBytes(predictorRowBytes(colors, bpc, columns)),
+    inRow(rowBytes + (png ? 1 : 0)), row(rowBytes), prevRow(rowBytes)
+{
+  bpp = std::max<std::size_t>(1, static_cast<std::size_t>(colors) * bpc / 8);
+  setg(row.data(), row.data(), row.data());
+}
+
+std::string deflate(std::string_view data, int level) {
+  if(level < -1 || level > 9)
+    throw decode_error("zlib", "invalid compression level", -1);
+#ifdef PDF_USE_LIBDEFLATE
+  if(inflateBackend() == InflateBackend::libdeflate) {
+    struct Deleter {
+      void operator()(libdeflate_compressor* c) { libdeflate_free_compressor(c); }
+    };
+    // Levels are as in zlib; libdeflate's higher ones are slower than worth it here
+    thread_local int compressorLevel = -2;
+    thread_local std::unique_ptr<libdeflate_compressor, Deleter> compressor{};
+    if(compressorLevel != level) {
+      compressor.reset(libdeflate_alloc_compressor(level == -1 ? 6 : level));
+      compressorLevel = level;
+    }
+    if(compressor) {
+      std::string ret(libdeflate_zlib_compress_bound(compressor.get(), data.length()), '\0');
+      std::size_t len = libdeflate_zlib_compress(compressor.get(), data.data(), data.length(), ret.data(), ret.length());
+      if(len != 0) {
+        ret.resize(len);
+        return ret;
+      }
+    }
+  }
+#endif
+  internal::ZStream<internal::direction::compress> zs{level};
+  auto& stream = zs.get();
+  std::string ret(::deflateBound(&stream, data.length()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.length();
+  stream.next_out = reinterpret_cast<Bytef*>(ret.data());
+  stream.avail_out = ret.length();
+  // The output buffer is large enough for everything
+  if(::deflate(&stream, Z_FINISH) != Z_STREAM_END)
+    throw decode_error("zlib", stream.msg ? stream.msg : "deflate failed", -1);
+  ret.resize(stream.total_out);
+  return ret;
+}
+
+DeflateEncoder::DeflateEncoder(std::string& out_, int level, std::size_t bufSize_)
+  : out(out_), bufSize(std::max<std::size_t>(bufSize_, 1)),
+    stream(std::make_unique<decltype(stream)::element_type>(level)),
+    inBuffer(bufSize), finished(false)
+{
+  setp(inBuffer.data(), inBuffer.data() + inBuffer.size());
+}
+
+DeflateEncoder::~DeflateEncoder() = default;
+
+void DeflateEncoder::compress(const char_type* data, std::size_t len, bool last) {
+  auto& zstr = stream->get();
+  zstr.next_in = reinterpret_cast<Bytef*>(const_cast<char_type*>(data));
+  zstr.avail_in = len;
+  while(true) {
+    // Room for most of the output of this call, more if it doesn't suffice
+    std::size_t room = std::max<std::size_t>(len / 2, 16 << 10);
+    std::size_t used = out.length();
+    out.resize(used + room);
+    zstr.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+    zstr.avail_out = room;
+    int ret = ::deflate(&zstr, last ? Z_FINISH : Z_NO_FLUSH);
+    out.resize(used + room - zstr.avail_out);
+    if(ret == Z_STREAM_ERROR)
+      throw decode_error("zlib", zstr.msg ? zstr.msg : "deflate failed", -1);
+    if(last ? ret == Z_STREAM_END : zstr.avail_in == 0 && zstr.avail_out != 0)
+      return;
+  }
+}
+
+void DeflateEncoder::flushBuffer() {
+  if(pptr() != pbase())
+    compress(pbase(), pptr() - pbase(), false);
+  setp(inBuffer.data(), inBuffer.data() + inBuffer.size());
+}
+
+std::streambuf::int_type DeflateEncoder::overflow(int_type c) {
+  if(finished)
+    return traits_type::eof();
+  flushBuffer();
+  if(!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize DeflateEncoder::xsputn(const char_type* s, std::streamsize count) {
+  if(finished)
+    return 0;
+  if(static_cast<std::size_t>(count) < bufSize) {
+    if(epptr() - pptr() < count)
+      flushBuffer();
+    std::copy(s, s + count, pptr());
+    pbump(static_cast<int>(count));
+  } else {
+    // Large writes skip the buffer
+    flushBuffer();
+    for(std::streamsize done = 0; done < count; ) {
+      std::size_t len = std::min<std::size_t>(count - done, std::numeric_limits<uInt>::max());
+      compress(s + done, len, false);
+      done += len;
+    }
+  }
+  return count;
+}
+
+void DeflateEncoder::finish() {
+  if(finished)
+    return;
+  compress(pbase(), pptr() - pbase(), true);
+  setp(nullptr, nullptr);
+  finished = true;
+}
+
+std::streambuf::int_type PredictorDecoder::underflow() {
+  std::size_t len = in_sbuf->sgetn(inRow.data(), inRow.size());
+  if(len == 0)
+    return traits_type::eof();
+  // A truncated last row is decoded as far as it goes
+  if(png)
+    decodePNG(len - 1);
+  else
+    decodeTIFF(len);
+  setg(row.data(), row.data(), row.data() + len - (png ? 1 : 0));
+  return gptr() != egptr() ? traits_type::to_int_type(row[0]) : traits_type::eof();
+}
+
+void PredictorDecoder::decodePNG(std::size_t len) {
+  std::swap(row, prevRow);
+  auto in = reinterpret_cast<const unsigned char*>(&inRow[1]);
+  auto out = reinterpret_cast<unsigned char*>(row.data());
+  auto up = reinterpret_cast<const unsigned char*>(prevRow.data());
+  switch(inRow[0]) {
+    case 0: // None
+      std::copy(in, in + len, out);
+      break;
+    case 1: // Sub
+      for(std::size_t i = 0; i < len; i++)
+        out[i] = in[i] + (i >= bpp ? out[i - bpp] : 0);
+      break;
+    case 2: // Up
+      for(std::size_t i = 0; i < len; i++)
+        out[i] = in[i] + up[i];
+      break;
+    case 3: // Average
+      for(std::size_t i = 0; i < len; i++)
+        out[i] = in[i] + ((i >= bpp ? out[i - bpp] : 0) + up[i]) / 2;
+      break;
+    case 4: // Paeth
+      for(std::size_t i = 0; i < len; i++) {
+        int a = i >= bpp ? out[i - bpp] : 0;
+        int b = up[i];
+        int c = i >= bpp ? up[i - bpp] : 0;
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        out[i] = in[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+      }
+      break;
+    default:
+      throw decode_error("Predictor", "Invalid PNG filter type", -1);
+  }
+}
+
+void PredictorDecoder::decodeTIFF(std::size_t len) {
+  auto in = reinterpret_cast<const unsigned char*>(inRow.data());
+  auto out = reinterpret_cast<unsigned char*>(row.data());
+  if(bpc == 8) {
+    for(std::size_t i = 0; i < len; i++)
+      out[i] = in[i] + (i >= colors ? out[i - colors] : 0);
+  } else if(bpc == 16) {
+    const std::size_t step = 2 * colors;
+    for(std::size_t i = 0; i + 1 < len; i += 2) {
+      unsigned v = (in[i] << 8 | in[i + 1]) + (i >= step ? out[i - step] << 8 | out[i + 1 - step] : 0);
+      out[i] = v >> 8;
+      out[i + 1] = v;
+    }
+    if(len % 2)
+      out[len - 1] = in[len - 1];
+  } else {
+    // Samples of 1, 2 or 4 bits, most significant first
+    const unsigned mask = (1u << bpc) - 1;
+    auto sample = [this, mask](const unsigned char* data, std::size_t ix) {
+      std::size_t bit = ix * bpc;
+      return (data[bit / 8] >> (8 - bpc - bit % 8)) & mask;
+    };
+    // The padding bits at the end of the row are copied as they are
+    std::copy(in, in + len, out);
+    for(std::size_t ix = 0; ix < std::min(len * 8 / bpc, samples); ix++) {
+      unsigned v = (sample(in, ix) + (ix >= colors ? sample(out, ix - colors) : 0)) & mask;
+      std::size_t bit = ix * bpc;
+      unsigned shift = 8 - bpc - bit % 8;
+      out[bit / 8] = (out[bit / 8] & ~(mask << shift)) | v << shift;
+    }
+  }
+}
+
+BlockDecoder::BlockDecoder(std::streambuf* in_sbuf_, std::size_t bufSize_)
+  : in_sbuf(in_sbuf_), bufSize(std::max<std::size_t>(bufSize_, 1)),
+    inBuffer(bufSize), outBuffer{}, inLen(0), finished(false)
+{
+  setg(nullptr, nullptr, nullptr);
+}
+
+std::streambuf::int_type BlockDecoder::underflow() {
+  outBuffer.clear();
+  while(outBuffer.empty() && !finished) {
+    // A decoder may need more than one block to make progress
+    if(inBuffer.size() - inLen < bufSize)
+      inBuffer.resize(inLen + bufSize);
+    std::size_t len = in_sbuf->sgetn(inBuffer.data() + inLen, bufSize);
+    bool last = len == 0;
+    inLen += len;
+    const char* start = inBuffer.data();
+    std::size_t used = decode(start, start + inLen, outBuffer, last) - start;
+    std::copy(inBuffer.begin() + used, inBuffer.begin() + inLen, inBuffer.begin());
+    inLen -= used;
+    if(last)
+      finished = true;
+  }
+  setg(outBuffer.data(), outBuffer.data(), outBuffer.data() + outBuffer.size());
+  return outBuffer.empty() ? traits_type::eof() : traits_type::to_int_type(outBuffer[0]);
+}
+
+namespace {
+
+int hexValue(char c) {
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  else if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  else if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  else
+    return -1;
+}
+
+} // anonymous namespace
+
+const char* ASCIIHexDecoder::decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) {
+  for(; ptr != end; ++ptr) {
+    if(int v = hexValue(*ptr); v >= 0) {
+      if(high < 0)
+        high = v;
       else {
-        assert(zstr.msg != NULL);
-        std::streamoff pos = static_cast<std::streamoff>(
-            in_sbuf->pubseekoff(0, std::ios::cur, std::ios::in))
-          - zstr.avail_in;
-        throw decode_error("zlib", zstr.msg, pos);
+        out.push_back(static_cast<char_type>(high << 4 | v));
+        high = -1;
+      }
+    } else if(*ptr == '>') {
+      finish();
+      last = true;
+      ptr = end;
+      break;
+    } else if(parser::charType(*ptr) != parser::CharType::ws)
+      throw decode_error("ASCIIHexDecode", "Invalid character", -1);
+  }
+  // An odd final digit stands for its high nibble
+  if(last && high >= 0) {
+    out.push_back(static_cast<char_type>(high << 4));
+    high = -1;
+  }
+  return ptr;
+}
+
+void ASCII85Decoder::flush(std::vector<char_type>& out) {
+  // A final partial group of n characters is padded with 'u' and gives n - 1 bytes
+  if(count == 1)
+    throw decode_error("ASCII85Decode", "Invalid final group", -1);
+  else if(count == 0)
+    return;
+  for(unsigned i = count; i < 5; i++)
+    group = group * 85 + 84;
+  for(unsigned i = 0; i < count - 1; i++)
+    out.push_back(static_cast<char_type>(group >> (24 - 8 * i)));
+  group = 0;
+  count = 0;
+}
+
+const char* ASCII85Decoder::decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) {
+  for(; ptr != end; ++ptr) {
+    char c = *ptr;
+    if(c >= '!' && c <= 'u') {
+      group = group * 85 + (c - '!');
+      if(++count == 5) {
+        if(group > 0xFFFFFFFF)
+          throw decode_error("ASCII85Decode", "Invalid group", -1);
+        for(int shift = 24; shift >= 0; shift -= 8)
+          out.push_back(static_cast<char_type>(group >> shift));
+        group = 0;
+        count = 0;
+      }
+    } else if(c == 'z' && count == 0)
+      out.insert(out.end(), 4, '\0');
+    else if(c == '~') {
+      // Only '>' may follow
+      finish();
+      flush(out);
+      return end;
+    } else if(parser::charType(c) != parser::CharType::ws)
+      throw decode_error("ASCII85Decode", "Invalid character", -1);
+  }
+  if(last)
+    flush(out);
+  return ptr;
+}
+
+const char* RunLengthDecoder::decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) {
+  while(ptr != end) {
+    unsigned len = static_cast<unsigned char>(*ptr);
+    if(len == 128) {
+      finish();
+      return end;
+    } else if(len < 128) {
+      // Literal run of len + 1 bytes
+      if(end - ptr < len + 2) {
+        if(last)
+          out.insert(out.end(), ptr + 1, end);
+        return last ? end : ptr;
+      }
+      out.insert(out.end(), ptr + 1, ptr + len + 2);
+      ptr += len + 2;
+    } else {
+      // The next byte repeated 257 - len times
+      if(end - ptr < 2)
+        return last ? end : ptr;
+      out.insert(out.end(), 257 - len, ptr[1]);
+      ptr += 2;
+    }
+  }
+  return ptr;
+}
+
+LZWDecoder::LZWDecoder(std::streambuf* in_sbuf_, unsigned earlyChange_, std::size_t bufSize_)
+  : BlockDecoder(in_sbuf_, bufSize_), earlyChange(earlyChange_ ? 1 : 0),
+    prefix(tableSize), length(tableSize), suffix(tableSize), first(tableSize),
+    bits(0), bitCount(0)
+{
+  for(unsigned c = 0; c < 256; c++) {
+    length[c] = 1;
+    suffix[c] = first[c] = static_cast<unsigned char>(c);
+  }
+  reset();
+}
+
+void LZWDecoder::reset() {
+  nextCode = eodCode + 1;
+  codeLen = 9;
+  prev = -1;
+}
+
+void LZWDecoder::output(unsigned code, std::vector<char_type>& out) {
+  // Strings are stored backwards, so fill from the end
+  std::size_t len = length[code];
+  out.resize(out.size() + len);
+  auto it = out.end();
+  for(std::size_t i = 0; i < len; i++, code = prefix[code])
+    *--it = static_cast<char_type>(suffix[code]);
+}
+
+const char* LZWDecoder::decode(const char* ptr, const char* end, std::vector<char_type>& out, bool) {
+  for(; ptr != end; ++ptr) {
+    bits = bits << 8 | static_cast<unsigned char>(*ptr);
+    bitCount += 8;
+    while(bitCount >= codeLen) {
+      bitCount -= codeLen;
+      unsigned code = (bits >> bitCount) & ((1u << codeLen) - 1);
+      if(code == clearCode) {
+        reset();
+        continue;
+      } else if(code == eodCode) {
+        finish();
+        return end;
+      } else if(prev < 0) {
+        if(code > 255)
+          throw decode_error("LZWDecode", "Invalid code", -1);
+        output(code, out);
+        prev = code;
+        continue;
+      } else if(code > nextCode || (code == nextCode && nextCode == tableSize))
+        throw decode_error("LZWDecode", "Invalid code", -1);
+      if(nextCode < tableSize) {
+        // If code is the one being defined, it starts with the previous string
+        prefix[nextCode] = prev;
+        suffix[nextCode] = code == nextCode ? first[prev] : first[code];
+        first[nextCode] = first[prev];
+        length[nextCode] = length[prev] + 1;
+        nextCode++;
+        if(nextCode + earlyChange >= (1u << codeLen) && codeLen < 12)
+          codeLen++;
       }
+      output(code, out);
+      prev = code;
     }
   }
-  setg(&outBuffer[0], &outBuffer[0], &outBuffer[readBytes]);
-  return traits_type::to_int_type(outBuffer[0]);
+  return ptr;
 }
 
 } // namespace pdf::codec
 
-DecoderChain::DecoderChain(const Stream& stm) : chain{}, inner{} {
-  chain.emplace_back(std::make_unique<std::stringbuf>(stm.data()));
-  const auto& filters = stm.dict().lookup("Filter");
+namespace {
+
+unsigned get_parm(const Object& parms, Symbol key, unsigned dflt) {
+  if(!parms.is<Dictionary>())
+    return dflt;
+  const auto& val = parms.get<Dictionary>().lookup(key);
+  if(!val)
+    return dflt;
+  else if(!val.is<Numeric>() || !val.get<Numeric>().uintegral()
+      || val.get<Numeric>().val_ulong() > std::numeric_limits<unsigned>::max())
+    throw codec::decode_error("", "Invalid /" + std::string{key.str()}, -1);
+  else
+    return static_cast<unsigned>(val.get<Numeric>().val_ulong());
+}
+
+} // anonymous namespace
+
+Stream recompress(const Stream& stm, int level) {
+  std::string compressed{};
+  try {
+    DecoderChain dc{stm};
+    if(!dc.complete())
+      return stm;
+    std::array<char, 64 << 10> chunk;
+    if(codec::inflateBackend() == codec::InflateBackend::libdeflate) {
+      // libdeflate only compresses in one call
+      std::string plain{};
+      while(std::size_t len = dc.read(chunk.data(), chunk.size()))
+        plain.append(chunk.data(), len);
+      compressed = codec::deflate(plain, level);
+    } else {
+      codec::DeflateEncoder enc{compressed, level};
+      while(std::size_t len = dc.read(chunk.data(), chunk.size()))
+        enc.sputn(chunk.data(), len);
+      enc.finish();
+    }
+  } catch(codec::decode_error&) {
+    return stm;
+  }
+  if(compressed.length() >= stm.data().length())
+    return stm;
+  Dictionary::Items items{};
+  for(const auto& [key, val] : stm.dict().items())
+    if(key != names::Filter && key != names::DecodeParms && key != names::Length)
+      items.emplace_back(key, val);
+  items.emplace_back(names::Filter, Object{Name{"FlateDecode"}});
+  items.emplace_back(names::Length, Object{Numeric{static_cast<long>(compressed.length())}});
+  return {Dictionary{std::move(items), ""}, std::move(compressed), ""};
+}
+
+DecoderChain Stream::decoder(std::size_t readAhead) const {
+  return DecoderChain{*this, readAhead};
+}
+
+DecoderChain::DecoderChain(const Stream& stm, std::size_t readAhead)
+  : chain{}, inner{}, blockSize{std::clamp(readAhead, minBlockSize, maxBlockSize)}, whole{readAhead == 0}
+{
+  chain.emplace_back(std::make_unique<InputBuffer>(stm.data(), stm.owner()));
+  const auto& filters = stm.dict().lookup(names::Filter);
+  const auto& parms = stm.dict().lookup(names::DecodeParms);
   if(!filters)
     return;
   else if(filters.is<Name>()) {
     const auto& filter = filters.get<Name>();
-    bool parsed = chain_append(filter);
+    bool parsed = chain_append(filter, parms);
     if(!parsed)
       inner = filter;
   } else if(filters.is<Array>()) {
-    for(const auto& entry : filters.get<pdf::Array>().items()) {
+    const auto& items = filters.get<pdf::Array>().items();
+    for(std::size_t i = 0; i < items.size(); i++) {
+      const auto& entry = items[i];
       if(!entry.is<pdf::Name>())
         throw codec::decode_error("", "Invalid /Filter", -1);
       const auto& filter = entry.get<pdf::Name>();
-      if(!chain_append(filter)) {
+      static const Object null{};
+      const auto& parm = parms.is<Array>() && i < parms.get<Array>().items().size()
+        ? parms.get<Array>().items()[i] : null;
+      if(!chain_append(filter, parm)) {
         inner = filter;
         break;
       }
@@ -129,12 +746,87 @@ DecoderChain::DecoderChain(const Stream& stm) : chain{}, inner{} {
     throw codec::decode_error("", "Invalid /Filter", -1);
 }
 
-bool DecoderChain::chain_append(const std::string& filter) {
+DecoderChain::~DecoderChain() {
+  // Decoders before their sources
+  while(!chain.empty())
+    chain.pop_back();
+}
+
+std::size_t DecoderChain::read(char* s, std::size_t len) {
+  std::size_t total = 0;
+  while(total < len) {
+    // sgetn() counts in std::streamsize
+    std::size_t part = std::min<std::size_t>(len - total, std::numeric_limits<std::streamsize>::max());
+    std::size_t got = rdbuf()->sgetn(s + total, part);
+    total += got;
+    if(got < part)
+      break;
+  }
+  return total;
+}
+
+std::string DecoderChain::read(std::size_t len) {
+  std::string ret{};
+  std::array<char, minBlockSize> chunk;
+  while(ret.length() < len) {
+    std::size_t got = read(chunk.data(), std::min(len - ret.length(), chunk.size()));
+    ret.append(chunk.data(), got);
+    if(got < chunk.size())
+      break;
+  }
+  return ret;
+}
+
+std::size_t DecoderChain::skip(std::size_t len) {
+  std::size_t total = 0;
+  std::vector<char> scratch(std::min(len, blockSize));
+  while(total < len) {
+    std::size_t part = std::min(len - total, scratch.size());
+    std::size_t got = read(scratch.data(), part);
+    total += got;
+    if(got < part)
+      break;
+  }
+  return total;
+}
+
+bool DecoderChain::chain_append(std::string_view filter, const Object& parms) {
+  // Defaults when reading whole streams, else blocks as asked for
+  const std::size_t deflateSize = whole ? codec::DeflateDecoder::defaultBufSize
+    : std::min(blockSize, codec::DeflateDecoder::defaultBufSize);
+  const std::size_t blockInput = whole ? codec::BlockDecoder::defaultBufSize
+    : std::min(blockSize, codec::BlockDecoder::defaultBufSize);
   if(filter == "FlateDecode") {
-    chain.emplace_back(std::make_unique<pdf::codec::DeflateDecoder>(chain.back().get()));
+    chain.emplace_back(std::make_unique<pdf::codec::DeflateDecoder>(chain.back().get(), deflateSize, whole));
+    return append_predictor(parms);
+  } else if(filter == "LZWDecode") {
+    chain.emplace_back(std::make_unique<pdf::codec::LZWDecoder>(chain.back().get(),
+          get_parm(parms, names::EarlyChange, 1), blockInput));
+    return append_predictor(parms);
+  } else if(filter == "ASCIIHexDecode") {
+    chain.emplace_back(std::make_unique<pdf::codec::ASCIIHexDecoder>(chain.back().get(), blockInput));
+    return true;
+  } else if(filter == "ASCII85Decode") {
+    chain.emplace_back(std::make_unique<pdf::codec::ASCII85Decoder>(chain.back().get(), blockInput));
     return true;
-  } else // TODO other decoders
+  } else if(filter == "RunLengthDecode") {
+    chain.emplace_back(std::make_unique<pdf::codec::RunLengthDecoder>(chain.back().get(), blockInput));
+    return true;
+  } else
     return false;
 }
 
+bool DecoderChain::append_predictor(const Object& parms) {
+  auto predictor = get_parm(parms, names::Predictor, 1);
+  if(predictor == 1)
+    return true;
+  else if(predictor == 2 || (predictor >= 10 && predictor <= 15)) {
+    chain.emplace_back(std::make_unique<pdf::codec::PredictorDecoder>(chain.back().get(), predictor,
+          get_parm(parms, names::Colors, 1), get_parm(parms, names::BitsPerComponent, 8),
+          get_parm(parms, names::Columns, 1)));
+    return true;
+  } else
+    throw codec::decode_error("", "Unsupported /Predictor", -1);
+}
+
 } // namespace pdf
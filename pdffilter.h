@@ -1,11 +1,14 @@
 #ifndef PDF_CODEC_H
 #define PDF_CODEC_H
 
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <streambuf>
 #include <vector>
 
 #include "pdfbase.h"
+#include "pdfinput.h"
 
 namespace pdf {
 
@@ -21,6 +24,20 @@ class decode_error : public std::runtime_error {
   std::string format(std::string_view component, std::string_view error, std::streamoff where);
 };
 
+/* Backend for inflating streams which are entirely in memory. libdeflate
+   is only available if compiled with PDF_USE_LIBDEFLATE, otherwise zlib
+   is always used. zlib also remains the fallback in case libdeflate fails,
+   e.g., on truncated streams, where it can recover partial data. */
+enum class InflateBackend {
+  zlib,
+  libdeflate
+};
+
+bool hasBackend(InflateBackend backend);
+// Applies to decoders created afterwards, in all threads.
+void setInflateBackend(InflateBackend backend);
+InflateBackend inflateBackend();
+
 namespace internal {
   enum class direction {
     compress,
@@ -29,37 +46,217 @@ namespace internal {
   template<direction> class ZStream;
 }
 
+/* Inflates in blocks of bufSize bytes. Reads of at least that size go
+   directly to the caller's buffer. If the input is an InputBuffer, zlib
+   reads its memory directly and no input buffer is allocated, or, with the
+   libdeflate backend, the whole stream is inflated in one call. */
 class DeflateDecoder : public std::streambuf {
   public:
-  DeflateDecoder(std::streambuf* in_sbuf_);
+  static constexpr std::size_t defaultBufSize = 128 * 1024;
+
+  // whole_ = false keeps libdeflate from inflating everything at once
+  DeflateDecoder(std::streambuf* in_sbuf_, std::size_t bufSize_ = defaultBufSize, bool whole_ = true);
   virtual ~DeflateDecoder();
 
   virtual int_type underflow() override;
+  virtual std::streamsize xsgetn(char_type* s, std::streamsize count) override;
 
   private:
-  static constexpr std::size_t bufSize = 1024;
-
+  std::size_t bufSize;
   std::streambuf* in_sbuf;
+  InputBuffer* in_mem;
   std::unique_ptr<internal::ZStream<internal::direction::decompress>> stream;
-  std::array<char_type, bufSize> inBuffer, outBuffer;
+  std::vector<char_type> inBuffer, outBuffer;
+  bool tryWhole, finished;
+
+  bool inflateWhole();
+  bool fill();
+  std::size_t inflate(char_type* out, std::size_t len);
+};
+
+/* Compresses data for /FlateDecode in a single call. level is as in zlib,
+   -1 being its default. With the libdeflate backend (see
+   setInflateBackend()), libdeflate compresses instead of zlib. */
+std::string deflate(std::string_view data, int level = -1);
+
+/* Compresses everything written to it for /FlateDecode, appending to out
+   as it goes, so the uncompressed data never need to be in memory as a
+   whole. Writes are collected up to bufSize bytes, larger ones are
+   compressed directly. finish() completes the stream; until then, out
+   holds an incomplete one. */
+class DeflateEncoder : public std::streambuf {
+  public:
+  static constexpr std::size_t defaultBufSize = 128 * 1024;
+
+  DeflateEncoder(std::string& out_, int level = -1, std::size_t bufSize_ = defaultBufSize);
+  virtual ~DeflateEncoder();
+
+  void finish();
+
+  protected:
+  virtual int_type overflow(int_type c) override;
+  virtual std::streamsize xsputn(const char_type* s, std::streamsize count) override;
+
+  private:
+  std::string& out;
+  std::size_t bufSize;
+  std::unique_ptr<internal::ZStream<internal::direction::compress>> stream;
+  std::vector<char_type> inBuffer;
+  bool finished;
+
+  void compress(const char_type* data, std::size_t len, bool last);
+  void flushBuffer();
+};
+
+/* Predictors from /DecodeParms: TIFF (/Predictor 2) undoes horizontal
+   differencing, PNG (/Predictor 10 to 15) has every row of the input start
+   with a byte selecting the filter used for that row. */
+class PredictorDecoder : public std::streambuf {
+  public:
+  PredictorDecoder(std::streambuf* in_sbuf_, unsigned predictor, unsigned colors, unsigned bpc, unsigned columns);
+
+  virtual int_type underflow() override;
+
+  private:
+  std::streambuf* in_sbuf;
+  bool png;
+  unsigned colors, bpc;
+  std::size_t samples; // per row, rowBytes may have padding bits after them
+  std::size_t bpp;
+  std::size_t rowBytes;
+  std::vector<char_type> inRow, row, prevRow;
+
+  void decodePNG(std::size_t len);
+  void decodeTIFF(std::size_t len);
+};
+
+/* Base for decoders which work on a block of input at a time. underflow()
+   reads up to bufSize bytes more from the source and passes everything
+   not consumed yet to decode(), until some output is produced. */
+class BlockDecoder : public std::streambuf {
+  public:
+  static constexpr std::size_t defaultBufSize = 64 * 1024;
+
+  BlockDecoder(std::streambuf* in_sbuf_, std::size_t bufSize_ = defaultBufSize);
+
+  virtual int_type underflow() override;
+
+  protected:
+  /* Decodes from [ptr, end) into out, returns where it stopped. Input left
+     over is passed again with more appended. If last is set, there is no
+     more. Calls finish() if it finds the end-of-data marker. */
+  virtual const char* decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) = 0;
+  void finish() { finished = true; }
+
+  private:
+  std::streambuf* in_sbuf;
+  std::size_t bufSize;
+  std::vector<char_type> inBuffer, outBuffer;
+  std::size_t inLen;
+  bool finished;
+};
+
+class ASCIIHexDecoder : public BlockDecoder {
+  public:
+  using BlockDecoder::BlockDecoder;
+
+  protected:
+  virtual const char* decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) override;
+
+  private:
+  int high = -1;
+};
+
+class ASCII85Decoder : public BlockDecoder {
+  public:
+  using BlockDecoder::BlockDecoder;
+
+  protected:
+  virtual const char* decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) override;
+
+  private:
+  std::uint64_t group = 0;
+  unsigned count = 0;
+
+  void flush(std::vector<char_type>& out);
+};
+
+class RunLengthDecoder : public BlockDecoder {
+  public:
+  using BlockDecoder::BlockDecoder;
+
+  protected:
+  virtual const char* decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) override;
+};
+
+class LZWDecoder : public BlockDecoder {
+  public:
+  LZWDecoder(std::streambuf* in_sbuf_, unsigned earlyChange_, std::size_t bufSize_ = defaultBufSize);
+
+  protected:
+  virtual const char* decode(const char* ptr, const char* end, std::vector<char_type>& out, bool last) override;
+
+  private:
+  static constexpr unsigned tableSize = 4096;
+  static constexpr unsigned clearCode = 256;
+  static constexpr unsigned eodCode = 257;
+
+  unsigned earlyChange;
+  // Every code is the string of its prefix code plus one character
+  std::vector<std::uint16_t> prefix, length;
+  std::vector<unsigned char> suffix, first;
+  unsigned nextCode, codeLen;
+  int prev;
+  std::uint32_t bits;
+  unsigned bitCount;
+
+  void reset();
+  void output(unsigned code, std::vector<char_type>& out);
 };
 
 } // namespace pdf::codec
 
+/* The filters of a stream, decoding lazily as the data are read from
+   rdbuf(). With readAhead nonzero, the decoders work in blocks of about
+   that size, for callers which only need a part, e.g., the first bytes;
+   otherwise, the stream is expected to be read whole. The blocks are never
+   larger than when reading whole, however large readAhead is. Destroying the chain
+   early just drops the decoders' state, the rest is never decoded. */
 class DecoderChain {
   std::vector<std::unique_ptr<std::streambuf>> chain;
   std::string inner;
+  std::size_t blockSize;
+  bool whole;
 
 public:
-  DecoderChain(const Stream&);
+  // Limits of the block size with readAhead
+  static constexpr std::size_t minBlockSize = 4096;
+  static constexpr std::size_t maxBlockSize = codec::DeflateDecoder::defaultBufSize;
+
+  DecoderChain(const Stream&, std::size_t readAhead = 0);
+  DecoderChain(DecoderChain&&) = default;
+  ~DecoderChain();
+
   std::streambuf* rdbuf() const { return chain.back().get(); }
   const std::string& last() const { return inner; }
   bool complete() const { return last().empty(); }
 
+  // These return how much was read or skipped, less only at the end.
+  std::size_t read(char* s, std::size_t len);
+  std::string read(std::size_t len);
+  std::size_t skip(std::size_t len);
+
 private:
-  bool chain_append(const std::string&);
+  bool chain_append(std::string_view filter, const Object& parms);
+  bool append_predictor(const Object& parms);
 };
 
+/* The data of stm decoded and compressed again with /FlateDecode, with
+   /Filter, /DecodeParms and /Length to match. stm is returned as it is if
+   a filter can't be decoded here (e.g., images), if decoding fails, or if
+   the result wouldn't be smaller. */
+Stream recompress(const Stream& stm, int level = -1);
+
 } // namespace pdf
 
 #endif
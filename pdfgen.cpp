@@ -0,0 +1,221 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "pdf.h"
+
+/* Synthetic inputs for the benchmarks. The output only depends on the
+   arguments, the generator is seeded with a constant. */
+
+// Objects written so far and where, for the xref table
+class Builder {
+  std::string _data;
+  std::vector<std::size_t> _offsets;
+
+  public:
+  Builder() : _data{"%PDF-1.7\n%\xe2\xe3\xcf\xd3\n"}, _offsets{} { }
+
+  std::size_t next() const { return _offsets.size() + 1; }
+
+  // Starts an object, the caller adds the contents and finishes with end()
+  std::string& begin() {
+    _offsets.push_back(_data.length());
+    _data += std::to_string(_offsets.size()) + " 0 obj\n";
+    return _data;
+  }
+
+  void end() {
+    _data += "\nendobj\n";
+  }
+
+  void stream(const std::string& dict, const std::string& contents, bool length = true) {
+    std::string& d = begin();
+    d += "<< " + dict;
+    if(length)
+      d += " /Length " + std::to_string(contents.length());
+    d += " >>\nstream\n" + contents + "\nendstream";
+    end();
+  }
+
+  std::string& data() { return _data; }
+
+  // Appends the xref table, trailer and startxref.
+  void finish(std::size_t root) {
+    std::size_t start = _data.length();
+    _data += "xref\n0 " + std::to_string(_offsets.size() + 1) + "\n0000000000 65535 f \n";
+    char row[21];
+    for(std::size_t off : _offsets) {
+      std::snprintf(row, sizeof(row), "%010zu 00000 n \n", off);
+      _data.append(row, 20);
+    }
+    _data += "trailer\n<< /Size " + std::to_string(_offsets.size() + 1)
+      + " /Root " + std::to_string(root) + " 0 R >>\nstartxref\n" + std::to_string(start) + "\n%%EOF\n";
+  }
+};
+
+// A page tree with count pages, each with a content stream, and the catalog.
+std::size_t pages(Builder& b, std::size_t count) {
+  std::size_t tree = b.next() + 2 * count;
+  for(std::size_t i = 0; i < count; i++) {
+    std::size_t contents = b.next();
+    b.stream("", "BT /F1 12 Tf 72 712 Td (Page " + std::to_string(i + 1) + ") Tj ET");
+    b.begin() += "<< /Type /Page /Parent " + std::to_string(tree) + " 0 R /MediaBox [0 0 612 792] /Contents "
+      + std::to_string(contents) + " 0 R >>";
+    b.end();
+  }
+  std::string& d = b.begin();
+  d += "<< /Type /Pages /Count " + std::to_string(count) + " /Kids [";
+  for(std::size_t i = 0; i < count; i++)
+    d += std::to_string(tree - 2 * count + 2 * i + 1) + " 0 R ";
+  d += "] >>";
+  b.end();
+  b.begin() += "<< /Type /Catalog /Pages " + std::to_string(tree) + " 0 R >>";
+  b.end();
+  return b.next() - 1;
+}
+
+// Many tiny objects, so that the xref table is a large part of the file.
+void genXRef(Builder& b, std::size_t count, std::mt19937&) {
+  for(std::size_t i = 0; i < count; i++) {
+    b.begin() += std::to_string(i);
+    b.end();
+  }
+  b.finish(pages(b, 1));
+}
+
+// Small objects of all kinds, dictionaries and arrays referring to each other.
+void genSmall(Builder& b, std::size_t count, std::mt19937& rng) {
+  std::uniform_int_distribution<unsigned> kind{0, 5};
+  for(std::size_t i = 0; i < count; i++) {
+    std::string& d = b.begin();
+    std::size_t ref = 1 + rng() % b.next();
+    switch(kind(rng)) {
+      case 0:
+        d += "<< /Type /Annot /Subtype /Link /Rect [" + std::to_string(rng() % 600) + " 10 200.5 -3.25] /Border [0 0 0] /Dest ["
+          + std::to_string(ref) + " 0 R /XYZ null null 0] >>";
+        break;
+      case 1:
+        d += "[" + std::to_string(ref) + " 0 R " + std::to_string(rng() % 1000) + " 0 R 1 2 3 4.5 /Name true false null]";
+        break;
+      case 2:
+        d += "(A string with \\(escapes\\) and \\n octal \\101 characters, number " + std::to_string(i) + ")";
+        break;
+      case 3:
+        d += "<feff00480065006c006c006f0020" + std::to_string(100000 + i) + ">";
+        break;
+      case 4:
+        d += "<< /Font << /F1 " + std::to_string(ref) + " 0 R >> /ProcSet [/PDF /Text] /ExtGState << /GS1 << /LW 1 /LC 0 >> >> >>";
+        break;
+      default:
+        d += std::to_string(rng() % 100000) + "." + std::to_string(rng() % 1000);
+    }
+    b.end();
+  }
+  b.finish(pages(b, count / 100 + 1));
+}
+
+// Flate-compressed RGB images of size x size pixels, smooth with some noise.
+void genImages(Builder& b, std::size_t count, std::mt19937& rng) {
+  constexpr std::size_t size = 1024;
+  std::string pixels(size * size * 3, '\0');
+  for(std::size_t i = 0; i < count; i++) {
+    for(std::size_t y = 0; y < size; y++)
+      for(std::size_t x = 0; x < size; x++) {
+        char* p = &pixels[(y * size + x) * 3];
+        p[0] = static_cast<char>(x + i);
+        p[1] = static_cast<char>(y);
+        p[2] = static_cast<char>((rng() & 15) + (x ^ y));
+      }
+    b.stream("/Type /XObject /Subtype /Image /Width 1024 /Height 1024 /ColorSpace /DeviceRGB /BitsPerComponent 8 /Filter /FlateDecode",
+        pdf::codec::deflate(pixels));
+  }
+  b.finish(pages(b, 1));
+}
+
+/* Objects with the usual kinds of damage: streams without /Length or with
+   a wrong one, garbage between objects, missing endobj, unterminated
+   strings, and a startxref pointing nowhere. The first streams have
+   predictor parameters out of range, up to rows of gigabytes. */
+void genDamaged(Builder& b, std::size_t count, std::mt19937& rng) {
+  std::uniform_int_distribution<unsigned> kind{0, 7};
+  std::string content(2000, 'x');
+  b.stream("/Filter /FlateDecode /DecodeParms << /Predictor 12 /Colors 4294967295 /BitsPerComponent 16 /Columns 4294967295 >>",
+      pdf::codec::deflate(content));
+  b.stream("/Filter /FlateDecode /DecodeParms << /Predictor 2 /Colors 4294967296 >>", pdf::codec::deflate(content));
+  for(std::size_t i = 0; i < count; i++) {
+    switch(kind(rng)) {
+      case 0:
+        b.stream("/Filter /FlateDecode", pdf::codec::deflate(content + std::to_string(i)), false);
+        break;
+      case 1:
+        b.begin() += "<< /Length 10 >>\nstream\n" + content + "\nendstream";
+        b.end();
+        break;
+      case 2:
+        b.data() += "garbage ) >> ] " + std::to_string(rng()) + "\n";
+        break;
+      case 3:
+        // No endobj
+        b.begin() += "<< /A [1 2 3] /B (str) >>\n";
+        break;
+      case 4:
+        b.begin() += "(unterminated " + content.substr(0, 100);
+        b.end();
+        break;
+      default:
+        b.begin() += "<< /Type /Dummy /N " + std::to_string(i) + " >>";
+        b.end();
+    }
+  }
+  b.finish(pages(b, 1));
+  auto pos = b.data().rfind("startxref\n");
+  b.data().replace(pos + 10, std::string::npos, "999999999\n%%EOF\n");
+}
+
+void usage(const char* argv0) {
+  std::cerr << "Usage: " << argv0 << " {xref|small|images|damaged} output.pdf [count]\n"
+    << "  xref     many tiny objects, default 200000\n"
+    << "  small    small dictionaries, arrays and strings, default 100000\n"
+    << "  images   1024x1024 Flate images, default 16\n"
+    << "  damaged  a mix of broken objects with a broken startxref, default 20000\n";
+}
+
+int main(int argc, char* argv[]) {
+  if(argc < 3 || argc > 4) {
+    usage(argv[0]);
+    return 1;
+  }
+  const std::string kind = argv[1];
+  struct Kind {
+    const char* name;
+    void (*gen)(Builder&, std::size_t, std::mt19937&);
+    std::size_t count;
+  };
+  const Kind kinds[] = {
+    {"xref", genXRef, 200000},
+    {"small", genSmall, 100000},
+    {"images", genImages, 16},
+    {"damaged", genDamaged, 20000}
+  };
+  const Kind* k = nullptr;
+  for(const auto& cand : kinds)
+    if(kind == cand.name)
+      k = &cand;
+  std::size_t count = k ? k->count : 0;
+  if(!k || (argc == 4 && std::sscanf(argv[3], "%zu", &count) != 1)) {
+    usage(argv[0]);
+    return 1;
+  }
+  std::mt19937 rng{1};
+  Builder b{};
+  k->gen(b, count, rng);
+  std::ofstream ofs{argv[2], std::ios::binary};
+  ofs.write(b.data().data(), b.data().length());
+  if(!ofs) {
+    std::cerr << "Can't write " << argv[2] << '\n';
+    return 1;
+  }
+}
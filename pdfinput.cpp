@@ -0,0 +1,95 @@
+#include <fstream>
+#include <system_error>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pdfinput.h"
+
+namespace pdf {
+
+/***** MappedFile *****/
+
+MappedFile::MappedFile(const std::string& filename) : _data{nullptr}, _size{0} {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd == -1)
+    throw std::system_error(errno, std::generic_category(), filename);
+  struct stat st;
+  if(int err = ::fstat(fd, &st) == -1 ? errno : !S_ISREG(st.st_mode) ? ENODEV : 0; err != 0) {
+    ::close(fd);
+    throw std::system_error(err, std::generic_category(), filename);
+  }
+  _size = st.st_size;
+  if(_size > 0) {
+    void* addr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(addr == MAP_FAILED) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), filename);
+    }
+    ::madvise(addr, _size, MADV_SEQUENTIAL);
+    _data = static_cast<const char*>(addr);
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if(_data)
+    ::munmap(const_cast<char*>(_data), _size);
+}
+
+/***** InputBuffer *****/
+
+InputBuffer::InputBuffer(std::string_view data_, std::shared_ptr<const void> owner_, std::streamoff base_)
+  : _owner(std::move(owner_)), _base(base_)
+{
+  char* base = const_cast<char*>(data_.data());
+  setg(base, base, base + data_.length());
+}
+
+std::streamsize InputBuffer::showmanyc() {
+  return gptr() == egptr() ? -1 : egptr() - gptr();
+}
+
+std::streambuf::pos_type InputBuffer::seekoff(off_type off, std::ios_base::seekdir dir,
+    std::ios_base::openmode which) {
+  if(!(which & std::ios_base::in))
+    return pos_type(off_type(-1));
+  off_type base;
+  if(dir == std::ios_base::beg)
+    base = 0;
+  else if(dir == std::ios_base::cur)
+    base = offset(gptr());
+  else
+    base = offset(egptr());
+  return seekpos(pos_type(base + off), which);
+}
+
+std::streambuf::pos_type InputBuffer::seekpos(pos_type pos, std::ios_base::openmode which) {
+  off_type off = off_type(pos) - _base;
+  if(!(which & std::ios_base::in) || off < 0 || off > egptr() - eback())
+    return pos_type(off_type(-1));
+  setg(eback(), eback() + off, egptr());
+  return pos;
+}
+
+/***** Opening input *****/
+
+std::unique_ptr<std::streambuf> openInput(const std::string& filename) {
+  // Pipes and devices must not be opened twice, so check before trying
+  if(struct stat st; ::stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+    try {
+      return std::make_unique<InputBuffer>(std::make_shared<const MappedFile>(filename));
+    } catch(std::system_error&) {
+      // mmap not supported here, fall through
+    }
+  }
+  auto fb = std::make_unique<std::filebuf>();
+  if(!fb->open(filename, std::ios_base::in | std::ios_base::binary))
+    return nullptr;
+  return fb;
+}
+
+} //namespace pdf
@@ -0,0 +1,64 @@
+#ifndef PDF_INPUT_H
+#define PDF_INPUT_H
+
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <memory>
+
+namespace pdf {
+
+/* Read-only memory mapping of an entire file. Throws std::system_error if
+   the file can't be opened or mapped (e.g., it's a pipe). */
+class MappedFile {
+  const char* _data;
+  std::size_t _size;
+
+  public:
+  MappedFile(const std::string& filename);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  std::string_view view() const { return {_data, _size}; }
+};
+
+/* A seekable, read-only streambuf over a contiguous block of memory. Parsing
+   functions recognize it and work on the memory directly instead of going
+   through the streambuf interface. The optional owner keeps the memory
+   alive for as long as this buffer or anything referring to it exists.
+   If the memory is a window into a larger input starting at base, stream
+   positions and offset() are counted from the start of that input. */
+class InputBuffer : public std::streambuf {
+  std::shared_ptr<const void> _owner;
+  std::streamoff _base;
+
+  public:
+  InputBuffer(std::string_view data_, std::shared_ptr<const void> owner_ = {}, std::streamoff base_ = 0);
+  InputBuffer(std::shared_ptr<const MappedFile> file_)
+    : InputBuffer(file_->view(), file_) { }
+
+  std::string_view data() const { return {eback(), static_cast<std::size_t>(egptr() - eback())}; }
+  const char* begin() const { return eback(); }
+  const char* cur() const { return gptr(); }
+  const char* end() const { return egptr(); }
+  std::string_view remaining() const { return {gptr(), static_cast<std::size_t>(egptr() - gptr())}; }
+
+  void seek(const char* ptr) { setg(eback(), const_cast<char*>(ptr), egptr()); }
+  std::streamoff offset(const char* ptr) const { return _base + (ptr - eback()); }
+
+  const std::shared_ptr<const void>& owner() const { return _owner; }
+
+  protected:
+  std::streamsize showmanyc() override;
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+};
+
+/* Opens a file for parsing: memory-mapped if possible, falling back to
+   a std::filebuf otherwise. Returns nullptr if the file can't be opened. */
+std::unique_ptr<std::streambuf> openInput(const std::string& filename);
+
+} // namespace pdf
+
+#endif
@@ -1,38 +1,49 @@
+#include <array>
+
 #include "pdfobjstream.h"
 
 namespace pdf::parser {
 
-ObjStream::ObjStream(const Stream& stm) :
-    stm{stm}, dd{stm}, ts{dd.rdbuf()}, nums{},
-    first{0}, ix{0}, fail{false} {
+namespace {
+
+std::string decode(const Stream& stm) {
+  DecoderChain dd{stm};
   if(!dd.complete())
     throw objstm_error{"Couldn't unpack object stream"};
-  const auto& oN = stm.dict().lookup("N");
-  const auto& oFirst = stm.dict().lookup("First");
+  std::string ret{};
+  std::array<char, 65536> chunk;
+  while(auto len = dd.rdbuf()->sgetn(chunk.data(), chunk.size()))
+    ret.append(chunk.data(), len);
+  return ret;
+}
+
+} // anonymous namespace
+
+ObjStream::ObjStream(const Stream& stm) :
+    storage{stm.dict().lookup(names::Filter) ? decode(stm) : std::string{}},
+    buf{stm.dict().lookup(names::Filter) ? std::string_view{storage} : stm.data()},
+    entries{}, index{}, first{0}, ix{0}, fail{false} {
+  const auto& oN = stm.dict().lookup(names::N);
+  const auto& oFirst = stm.dict().lookup(names::First);
   if(!oN.is<Numeric>() || !oN.get<Numeric>().uintegral()
       || !oFirst.is<Numeric>() || !oFirst.get<Numeric>().uintegral())
     throw objstm_error{"Object stream lacks required fields"};
   unsigned long count = oN.get<Numeric>().val_ulong();
   first = oFirst.get<Numeric>().val_ulong();
+  TokenParser ts{&buf};
   for(auto i = 0ul; i < count; i++) {
-    Numeric num{ts.read()};
+    Numeric num{ts.read().text};
     if(!num.uintegral())
       throw objstm_error{"Broken object stream header"};
-    nums.push_back(num.val_ulong());
-    Numeric offset{ts.read()};
+    Numeric offset{ts.read().text};
     if(!offset.uintegral())
       throw objstm_error{"Broken object stream header"};
-    // offset ignored for now
+    index.emplace(num.val_ulong(), entries.size());
+    entries.emplace_back(num.val_ulong(), offset.val_ulong());
   }
 }
 
 void ObjStream::rewind() {
-  // We need to do this the stupid way because a basic_streambuf can't seek
-  // and sgetn needs an array to write to
-  dd = DecoderChain{stm};
-  ts.newstream(dd.rdbuf());
-  for(unsigned i = 0ul; i < first; i++)
-    dd.rdbuf()->sbumpc();
   ix = 0;
   fail = false;
 }
@@ -40,16 +51,34 @@ void ObjStream::rewind() {
 TopLevelObject ObjStream::read() {
   if(fail)
     return {Invalid{"Read on a failed ObjStream"}};
-  if(ix == nums.size()) {
+  if(ix == entries.size()) {
     fail = true;
     return {}; // EOF
   }
-  Object o = readObject(ts);
-  unsigned long num = nums[ix];
-  fail = o.failed();
+  TopLevelObject tlo = read(ix);
+  fail = tlo.failed();
   if(!fail)
     ++ix;
+  return tlo;
+}
+
+TopLevelObject ObjStream::read(std::size_t ix_) {
+  if(ix_ >= entries.size())
+    return {Invalid{"Index out of range of ObjStream"}};
+  auto [num, offset] = entries[ix_];
+  if(first > buf.data().length() || offset > buf.data().length() - first)
+    return {Invalid{"Object offset out of range of ObjStream"}};
+  buf.seek(buf.begin() + first + offset);
+  TokenParser ts{&buf};
+  Object o = readObject(ts);
   return {NamedObject{num, 0, std::move(o), ""}};
 }
 
+TopLevelObject ObjStream::find(unsigned long num) {
+  if(auto it = index.find(num); it != index.end())
+    return read(it->second);
+  else
+    return {};
+}
+
 } // namespace pdf::parser
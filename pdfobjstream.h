@@ -2,9 +2,11 @@
 #define PDF_OBJSTREAM_H
 
 #include <stdexcept>
+#include <map>
 #include <vector>
 
 #include "pdfbase.h"
+#include "pdfinput.h"
 #include "pdfparser.h"
 #include "pdffilter.h"
 
@@ -14,20 +16,34 @@ struct objstm_error : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+/* The stream is decoded once, in the constructor. Objects can then be read
+   in any order using the offsets given in the header. If the stream is not
+   encoded, its data is used in place, so it must outlive the ObjStream. */
 class ObjStream {
-  const Stream& stm;
-  DecoderChain dd;
-  TokenParser ts;
-  std::vector<unsigned long> nums;
+  std::string storage;
+  InputBuffer buf;
+  std::vector<std::pair<unsigned long, unsigned long>> entries; // (num, offset)
+  std::map<unsigned long, std::size_t> index;
   unsigned long first;
-  unsigned long ix;
+  std::size_t ix;
   bool fail;
 
 public:
   ObjStream(const pdf::Stream& stm);
+  ObjStream(const ObjStream&) = delete;
+  ObjStream& operator=(const ObjStream&) = delete;
 
+  std::size_t size() const { return entries.size(); }
+  // Number of the object at an index, as given in the header
+  unsigned long number(std::size_t index) const { return entries[index].first; }
+
+  // Sequential access
   void rewind();
   TopLevelObject read();
+
+  // Random access: by position in the stream, or by object number
+  TopLevelObject read(std::size_t index);
+  TopLevelObject find(unsigned long num);
 };
 
 } // namespace pdf::parser
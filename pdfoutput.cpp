@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pdfoutput.h"
+
+namespace pdf {
+
+/***** OutputBuffer *****/
+
+std::streambuf::int_type OutputBuffer::overflow(int_type c) {
+  if(!traits_type::eq_int_type(c, traits_type::eof()))
+    _data.push_back(traits_type::to_char_type(c));
+  return traits_type::not_eof(c);
+}
+
+std::streamsize OutputBuffer::xsputn(const char_type* s, std::streamsize count) {
+  _data.append(s, count);
+  return count;
+}
+
+void OutputBuffer::clear() {
+  if(_data.capacity() > keepCapacity)
+    _data = std::string{};
+  else
+    _data.clear();
+}
+
+/***** Writing to file descriptors *****/
+
+namespace {
+
+void writeAll(int fd, std::string_view data, const std::string& filename) {
+  while(!data.empty()) {
+    ssize_t len = ::write(fd, data.data(), data.length());
+    if(len == -1) {
+      if(errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::generic_category(), filename);
+    }
+    data.remove_prefix(len);
+  }
+}
+
+} // anonymous namespace
+
+/***** DirectorySink *****/
+
+void DirectorySink::write(const std::string& name, std::string_view contents) {
+  int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(fd == -1)
+    throw std::system_error(errno, std::generic_category(), name);
+  try {
+    writeAll(fd, contents, name);
+  } catch(...) {
+    ::close(fd);
+    throw;
+  }
+  if(::close(fd) == -1)
+    throw std::system_error(errno, std::generic_category(), name);
+}
+
+namespace {
+
+class DirectoryFile : public OutputFile {
+  int _fd;
+  std::string _name;
+
+  public:
+  DirectoryFile(const std::string& name) : _fd{-1}, _name{name} {
+    _fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(_fd == -1)
+      throw std::system_error(errno, std::generic_category(), name);
+  }
+
+  ~DirectoryFile() {
+    if(_fd != -1)
+      ::close(_fd);
+  }
+
+  void write(std::string_view data) override {
+    writeAll(_fd, data, _name);
+  }
+
+  void close() override {
+    int fd = std::exchange(_fd, -1);
+    if(::close(fd) == -1)
+      throw std::system_error(errno, std::generic_category(), _name);
+  }
+};
+
+} // anonymous namespace
+
+std::unique_ptr<OutputFile> DirectorySink::open(const std::string& name) {
+  return std::make_unique<DirectoryFile>(name);
+}
+
+/***** TarSink *****/
+
+namespace {
+
+constexpr std::size_t blockSize = 512;
+// Data are kept until there's this much
+constexpr std::size_t flushSize = 1 << 20;
+
+} // anonymous namespace
+
+TarSink::TarSink(const std::string& filename)
+  : _fd{-1}, _filename{filename}, _buffer{}, _closed{false}
+{
+  _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(_fd == -1)
+    throw std::system_error(errno, std::generic_category(), filename);
+  _buffer.reserve(flushSize + blockSize);
+}
+
+TarSink::~TarSink() {
+  try {
+    close();
+  } catch(std::system_error&) {
+    // Can't report from here
+  }
+}
+
+void TarSink::write(const std::string& name, std::string_view contents) {
+  std::lock_guard lock{_mutex};
+  member(name, contents.length());
+  append(contents);
+  pad(contents.length());
+}
+
+class TarSink::File : public OutputFile {
+  TarSink& _sink;
+  std::string _name;
+  std::string _data;
+  int _spill;
+  std::size_t _size;
+
+  public:
+  File(TarSink& sink_, const std::string& name_)
+    : _sink(sink_), _name{name_}, _data{}, _spill{-1}, _size{0} { }
+
+  ~File() {
+    if(_spill != -1)
+      ::close(_spill);
+  }
+
+  void write(std::string_view data) override {
+    _size += data.length();
+    if(_spill == -1 && _data.length() + data.length() <= flushSize) {
+      _data.append(data);
+      return;
+    }
+    if(_spill == -1) {
+      // Next to the archive, which is known to be writable
+      std::string tmpl = _sink._filename + ".XXXXXX";
+      _spill = ::mkstemp(tmpl.data());
+      if(_spill == -1)
+        throw std::system_error(errno, std::generic_category(), tmpl);
+      ::unlink(tmpl.c_str());
+      writeAll(_spill, std::exchange(_data, std::string{}), tmpl);
+    }
+    writeAll(_spill, data, _sink._filename);
+  }
+
+  void close() override {
+    std::lock_guard lock{_sink._mutex};
+    _sink.member(_name, _size);
+    if(_spill == -1)
+      _sink.append(_data);
+    else {
+      if(::lseek(_spill, 0, SEEK_SET) == -1)
+        throw std::system_error(errno, std::generic_category(), _sink._filename);
+      std::string chunk(flushSize, '\0');
+      for(std::size_t left = _size; left > 0; ) {
+        ssize_t len = ::read(_spill, chunk.data(), std::min(left, chunk.size()));
+        if(len == -1 && errno == EINTR)
+          continue;
+        if(len <= 0)
+          throw std::system_error(len == 0 ? EIO : errno, std::generic_category(), _sink._filename);
+        _sink.append({chunk.data(), static_cast<std::size_t>(len)});
+        left -= len;
+      }
+    }
+    _sink.pad(_size);
+  }
+};
+
+std::unique_ptr<OutputFile> TarSink::open(const std::string& name) {
+  return std::make_unique<File>(*this, name);
+}
+
+void TarSink::member(const std::string& name, std::size_t size) {
+  // Archive members are relative
+  std::string_view path{name};
+  while(!path.empty() && path.front() == '/')
+    path.remove_prefix(1);
+  if(path.length() > 100) {
+    // GNU extension: the name is the contents of a preceding pseudo-member
+    header("././@LongLink", path.length() + 1, 'L');
+    append(path);
+    append(std::string_view{"", 1});
+    pad(path.length() + 1);
+    path = path.substr(0, 100);
+  }
+  header(path, size, '0');
+}
+
+void TarSink::close() {
+  std::lock_guard lock{_mutex};
+  if(_closed)
+    return;
+  _closed = true;
+  // End of archive: two zero blocks
+  _buffer.append(2 * blockSize, '\0');
+  int fd = _fd;
+  _fd = -1;
+  try {
+    writeAll(fd, _buffer, _filename);
+  } catch(...) {
+    ::close(fd);
+    throw;
+  }
+  _buffer.clear();
+  if(::close(fd) == -1)
+    throw std::system_error(errno, std::generic_category(), _filename);
+}
+
+void TarSink::append(std::string_view data) {
+  if(_buffer.length() + data.length() > flushSize) {
+    flush();
+    // Large members bypass the buffer
+    if(data.length() >= flushSize) {
+      writeAll(_fd, data, _filename);
+      return;
+    }
+  }
+  _buffer.append(data);
+}
+
+void TarSink::pad(std::size_t size) {
+  if(size % blockSize)
+    _buffer.append(blockSize - size % blockSize, '\0');
+}
+
+void TarSink::header(std::string_view name, std::size_t size, char type) {
+  std::array<char, blockSize> h{};
+  auto field = [&h](std::size_t off, std::size_t len, std::string_view val) {
+    std::memcpy(&h[off], val.data(), std::min(len, val.length()));
+  };
+  auto octal = [&h](std::size_t off, std::size_t len, unsigned long long val) {
+    std::snprintf(&h[off], len, "%0*llo", static_cast<int>(len - 1), val);
+  };
+  field(0, 100, name);
+  octal(100, 8, 0644);
+  octal(108, 8, 0);
+  octal(116, 8, 0);
+  if(size < (1ull << 33))
+    octal(124, 12, size);
+  else {
+    // GNU base-256 for large sizes
+    h[124] = '\x80';
+    for(int i = 0; i < 8; i++)
+      h[135 - i] = static_cast<char>(size >> (8 * i));
+  }
+  octal(136, 12, static_cast<unsigned long long>(std::time(nullptr)));
+  h[156] = type;
+  field(257, 6, "ustar");
+  field(263, 2, "00");
+  // The checksum is computed with its own field filled with spaces
+  std::memset(&h[148], ' ', 8);
+  unsigned sum = 0;
+  for(char c : h)
+    sum += static_cast<unsigned char>(c);
+  std::snprintf(&h[148], 7, "%06o", sum);
+  append({h.data(), h.size()});
+}
+
+void TarSink::flush() {
+  writeAll(_fd, _buffer, _filename);
+  _buffer.clear();
+}
+
+/***** OrderedWriter *****/
+
+OrderedWriter::OrderedWriter(Consumer consumer_, bool writerThread, std::size_t maxPending_)
+  : _consumer(std::move(consumer_)), _maxPending(std::max<std::size_t>(maxPending_, 1)),
+    _pending{}, _first(0), _writing(false), _stop(false), _error{}
+{
+  if(writerThread)
+    _thread = std::thread{&OrderedWriter::work, this};
+}
+
+OrderedWriter::~OrderedWriter() {
+  {
+    std::lock_guard lock{_mutex};
+    _stop = true;
+  }
+  _cvReady.notify_all();
+  if(_thread.joinable())
+    _thread.join();
+}
+
+std::size_t OrderedWriter::reserve() {
+  std::unique_lock lock{_mutex};
+  _cvRoom.wait(lock, [this] { return _pending.size() < _maxPending; });
+  _pending.emplace_back();
+  return _first + _pending.size() - 1;
+}
+
+void OrderedWriter::fill(std::size_t chunk, std::string data) {
+  Chunk contents{};
+  contents.data = std::move(data);
+  fill(chunk, std::move(contents));
+}
+
+void OrderedWriter::fill(std::size_t chunk, std::string_view data, std::shared_ptr<const void> owner) {
+  if(!owner) {
+    // Nothing says how long the data live
+    fill(chunk, std::string{data});
+    return;
+  }
+  Chunk contents{};
+  contents.view = data;
+  contents.owner = std::move(owner);
+  fill(chunk, std::move(contents));
+}
+
+void OrderedWriter::fill(std::size_t chunk, Chunk&& contents) {
+  std::unique_lock lock{_mutex};
+  Chunk& slot = _pending[chunk - _first];
+  slot = std::move(contents);
+  slot.ready = true;
+  if(chunk != _first)
+    return;
+  if(_thread.joinable())
+    _cvReady.notify_one();
+  else if(!_writing)
+    drain(lock);
+}
+
+// Passes on all chunks ready at the front, one thread at a time.
+void OrderedWriter::drain(std::unique_lock<std::mutex>& lock) {
+  _writing = true;
+  while(!_pending.empty() && _pending.front().ready) {
+    Chunk chunk = std::move(_pending.front());
+    _pending.pop_front();
+    _first++;
+    _cvRoom.notify_one();
+    if(_error)
+      continue;
+    lock.unlock();
+    try {
+      _consumer(chunk.owner ? chunk.view : std::string_view{chunk.data});
+    } catch(...) {
+      lock.lock();
+      _error = std::current_exception();
+      continue;
+    }
+    lock.lock();
+  }
+  _writing = false;
+  _cvDone.notify_all();
+}
+
+void OrderedWriter::work() {
+  std::unique_lock lock{_mutex};
+  while(true) {
+    _cvReady.wait(lock, [this] { return _stop || (!_pending.empty() && _pending.front().ready); });
+    if(_stop)
+      return;
+    drain(lock);
+  }
+}
+
+void OrderedWriter::finish() {
+  std::unique_lock lock{_mutex};
+  _cvDone.wait(lock, [this] { return _pending.empty() && !_writing; });
+  if(_error)
+    std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+} // namespace pdf
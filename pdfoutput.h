@@ -0,0 +1,153 @@
+#ifndef PDF_OUTPUT_H
+#define PDF_OUTPUT_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace pdf {
+
+/* Collects output in a std::string, which keeps its capacity across
+   clear(), so a buffer reused for many files stops allocating. Capacity
+   beyond keepCapacity is released by clear(). */
+class OutputBuffer : public std::streambuf {
+  std::string _data;
+
+  public:
+  static constexpr std::size_t keepCapacity = 4 << 20;
+
+  std::string_view data() const { return _data; }
+  std::size_t size() const { return _data.size(); }
+  void clear();
+
+  protected:
+  int_type overflow(int_type c) override;
+  std::streamsize xsputn(const char_type* s, std::streamsize count) override;
+};
+
+/* A file from OutputSink::open(), written in pieces. Nothing may follow
+   close(); a file destroyed without it may be left incomplete. */
+class OutputFile {
+  public:
+  virtual ~OutputFile() = default;
+
+  virtual void write(std::string_view data) = 0;
+  virtual void close() = 0;
+};
+
+/* Destination for a set of output files, each of which is written whole,
+   or through open() if it's too large to be held in memory. write() and
+   open() may be called from several threads at once. Errors are thrown
+   as std::system_error. */
+class OutputSink {
+  public:
+  virtual ~OutputSink() = default;
+
+  virtual void write(const std::string& name, std::string_view contents) = 0;
+  virtual std::unique_ptr<OutputFile> open(const std::string& name) = 0;
+  // Completes the output, no writes may follow.
+  virtual void close() { }
+};
+
+/* Files in the file system, each created by a single open and write, or
+   written as the data come with open(). */
+class DirectorySink : public OutputSink {
+  public:
+  void write(const std::string& name, std::string_view contents) override;
+  std::unique_ptr<OutputFile> open(const std::string& name) override;
+};
+
+/* All files in a single POSIX tar archive, written in large blocks.
+   Names longer than the ustar limit are stored as GNU long names. A member
+   needs its size in the header, so files from open() are kept in memory
+   up to the block size and in an unlinked temporary file beyond that,
+   then copied to the archive on close(). */
+class TarSink : public OutputSink {
+  class File;
+
+  int _fd;
+  std::string _filename;
+  std::string _buffer;
+  bool _closed;
+  std::mutex _mutex;
+
+  public:
+  TarSink(const std::string& filename);
+  TarSink(const TarSink&) = delete;
+  TarSink& operator=(const TarSink&) = delete;
+  // Closes the archive if close() wasn't called, ignoring errors
+  ~TarSink();
+
+  void write(const std::string& name, std::string_view contents) override;
+  std::unique_ptr<OutputFile> open(const std::string& name) override;
+  void close() override;
+
+  private:
+  // Headers for a member, under the lock
+  void member(const std::string& name, std::size_t size);
+  void append(std::string_view data);
+  void pad(std::size_t size);
+  void header(std::string_view name, std::size_t size, char type);
+  void flush();
+};
+
+/* Hands chunks of output to a consumer in the order they were reserved,
+   while they may be filled in any order, e.g., by jobs in a WorkerPool.
+   With writerThread, the consumer runs in a thread of its own, otherwise
+   in whichever thread fills the next chunk due. reserve() blocks while
+   maxPending chunks are waiting, which bounds the memory they hold. Every
+   reserved chunk must be filled, or finish() waits forever. If the
+   consumer throws, the rest is dropped and finish() rethrows. */
+class OrderedWriter {
+  public:
+  using Consumer = std::function<void(std::string_view)>;
+
+  private:
+  struct Chunk {
+    bool ready = false;
+    std::string data;
+    // Instead of data, memory kept alive by owner
+    std::string_view view{};
+    std::shared_ptr<const void> owner{};
+  };
+
+  Consumer _consumer;
+  std::size_t _maxPending;
+  std::deque<Chunk> _pending;
+  std::size_t _first; // number of the chunk at the front of _pending
+  bool _writing, _stop;
+  std::exception_ptr _error;
+  std::mutex _mutex;
+  std::condition_variable _cvReady, _cvRoom, _cvDone;
+  std::thread _thread;
+
+  public:
+  OrderedWriter(Consumer consumer_, bool writerThread, std::size_t maxPending_);
+  OrderedWriter(const OrderedWriter&) = delete;
+  OrderedWriter& operator=(const OrderedWriter&) = delete;
+  // Stops the writer thread, chunks not written yet are dropped
+  ~OrderedWriter();
+
+  // Returns the number of the next chunk, to be passed to fill().
+  std::size_t reserve();
+  void fill(std::size_t chunk, std::string data);
+  void fill(std::size_t chunk, std::string_view data, std::shared_ptr<const void> owner);
+  // Waits until all chunks are written.
+  void finish();
+
+  private:
+  void fill(std::size_t chunk, Chunk&& contents);
+  void drain(std::unique_lock<std::mutex>& lock);
+  void work();
+};
+
+} // namespace pdf
+
+#endif
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <cstdlib>
 #include <cassert>
+#include <unordered_set>
 
 #include "pdfparser.h"
 
@@ -9,17 +11,6 @@ namespace parser {
 
 /***** Helper classes and functions *****/
 
-CharType charType(char c) {
-  switch(c) {
-    case '\0': case '\t': case '\r': case '\n': case '\x0c': case ' ':
-      return CharType::ws;
-    case '(': case ')': case '<': case '>': case '[': case ']': case '{': case '}': case '/': case '%':
-      return CharType::delim;
-    default:
-      return CharType::regular;
-  }
-}
-
 namespace {
 
 void skipToLF(std::streambuf& stream) {
@@ -67,6 +58,25 @@ std::string chopNL(std::string&& in) {
   return in;
 }
 
+/* Finds the first occurrence of keyword in data which is not immediately
+   followed by a regular character. Returns npos if there is none. */
+std::size_t findKeyword(std::string_view data, std::string_view keyword) {
+  const char* end = data.data() + data.length();
+  for(const char* ptr = parser::findKeyword(data.data(), end, keyword); ptr != end;
+      ptr = parser::findKeyword(ptr + 1, end, keyword))
+    if(const char* after = ptr + keyword.length(); after == end || charType(*after) != CharType::regular)
+      return ptr - data.data();
+  return std::string_view::npos;
+}
+
+std::string_view chopNL(std::string_view in) {
+  if(!in.empty() && in.back() == '\n')
+    in.remove_suffix(1);
+  if(!in.empty() && in.back() == '\r')
+    in.remove_suffix(1);
+  return in;
+}
+
 std::string format_position(std::streamoff offset) {
   char buf[20];
   std::snprintf(buf, 50, "%zu", offset);
@@ -85,34 +95,62 @@ std::string readLine(std::streambuf& stream) {
 
 /***** Implementation of TokenParser *****/
 
-std::string TokenParser::underflow() {
+Token TokenParser::underflow() {
   char c;
   _lastLen = 0;
-  for(auto cInt = _stream->sgetc(); ; cInt = _stream->snextc()) {
-    if(cInt == std::streambuf::traits_type::eof())
-      return "";
-    c = std::streambuf::traits_type::to_char_type(cInt);
-    if(charType(c) != CharType::ws)
-      break;
-  }
+  if(_mem) {
+    const char* ptr = skipWS(_mem->cur(), _mem->end());
+    _mem->seek(ptr);
+    if(ptr == _mem->end())
+      return {TokenType::eof, {}};
+    c = *ptr;
+  } else
+    for(auto cInt = _stream->sgetc(); ; cInt = _stream->snextc()) {
+      if(cInt == std::streambuf::traits_type::eof())
+        return {TokenType::eof, {}};
+      c = std::streambuf::traits_type::to_char_type(cInt);
+      if(charType(c) != CharType::ws)
+        break;
+    }
   switch(charType(c)) {
     case CharType::delim:
       if(c == '%') {
+        if(_mem)
+          _mem->seek(findNL(_mem->cur(), _mem->end()));
         skipToNL(*_stream);
         return underflow();
       } else if(c == '<' || c == '>') {
         if(auto cInt = _stream->snextc(); std::streambuf::traits_type::to_char_type(cInt) == c) {
           _stream->sbumpc();
           _lastLen = 2;
-          return {c, c};
+          return c == '<' ? Token{TokenType::dictBegin, "<<"} : Token{TokenType::dictEnd, ">>"};
         }
       } else
         _stream->sbumpc(); // For < and > this was already done by snexts()
       _lastLen = 1;
-      return {c};
+      switch(c) {
+        case '/': return {TokenType::name, "/"};
+        case '(': return {TokenType::stringLit, "("};
+        case '<': return {TokenType::stringHex, "<"};
+        case '[': return {TokenType::arrayBegin, "["};
+        case ']': return {TokenType::arrayEnd, "]"};
+        case ')': return {TokenType::delim, ")"};
+        case '>': return {TokenType::delim, ">"};
+        case '{': return {TokenType::delim, "{"};
+        case '}': return {TokenType::delim, "}"};
+        default: throw std::logic_error("Unexpected delimiter");
+      }
     case CharType::regular:
-      {
-        std::string s{c};
+      if(_mem) {
+        // The token can refer directly to the input
+        const char* start = _mem->cur();
+        _mem->seek(skipRegular(start + 1, _mem->end()));
+        _lastLen = _mem->cur() - start;
+        return {TokenType::regular, {start, _lastLen}};
+      } else {
+        std::string& s = _scratch[_scratchIx];
+        _scratchIx = (_scratchIx + 1) % _scratch.size();
+        s.assign(1, c);
         for(auto cInt = _stream->snextc(); cInt != std::streambuf::traits_type::eof(); cInt = _stream->snextc()) {
           c = std::streambuf::traits_type::to_char_type(cInt);
           if(charType(c) == CharType::regular)
@@ -121,7 +159,7 @@ std::string TokenParser::underflow() {
             break;
         }
         _lastLen = s.length();
-        return s;
+        return {TokenType::regular, s};
       }
     case CharType::ws:
     default:
@@ -132,20 +170,20 @@ std::string TokenParser::underflow() {
 /***** Parse functions *****/
 
 Object parseName(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "/");
-  s = ts.read();
-  if(charType(s[0]) == CharType::regular)
-    return {Name{std::move(s)}};
+  Token t = ts.read();
+  assert(t == TokenType::name);
+  t = ts.read();
+  if(t == TokenType::regular)
+    return {Name{t.text}};
   else
     return {Invalid{"/ not followed by a proper name" + report_position(ts)}};
 }
 
 Object parseNumberIndir(TokenParser& ts, Numeric&& n1) {
-  std::string t2 = ts.read();
-  Numeric n2{t2};
+  Token t2 = ts.read();
+  Numeric n2{t2.text};
   if(n1.uintegral() && n2.uintegral()) {
-    auto t3 = ts.read();
+    Token t3 = ts.read();
     if(t3 == "R")
       return {Indirect{n1.val_ulong(), n2.val_ulong()}};
     else
@@ -156,11 +194,11 @@ Object parseNumberIndir(TokenParser& ts, Numeric&& n1) {
 }
 
 Object parseStringLiteral(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "(");
+  [[maybe_unused]] Token t = ts.read();
+  assert(t == TokenType::stringLit);
   assert(ts.empty());
   std::streambuf& stream = *ts.stream();
-  std::string ret{};
+  std::pmr::string ret{objectResource()};
   std::string error{};
   unsigned parens = 0;
 
@@ -252,11 +290,11 @@ end:
 }
 
 Object parseStringHex(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "<");
+  [[maybe_unused]] Token t = ts.read();
+  assert(t == TokenType::stringHex);
   assert(ts.empty());
   std::streambuf& stream = *ts.stream();
-  std::string ret{};
+  std::pmr::string ret{objectResource()};
   std::string error{};
   unsigned odd = 0;
   char d = 0;
@@ -295,11 +333,11 @@ Object parseStringHex(TokenParser& ts) {
 }
 
 Object parseArray(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "[");
-  std::vector<Object> array{};
+  [[maybe_unused]] Token t = ts.read();
+  assert(t == TokenType::arrayBegin);
+  Array::Items array{objectResource()};
   std::string error{};
-  while(ts.peek() != "]") {
+  while(ts.peek() != TokenType::arrayEnd) {
     Object o = readObject(ts);
     bool failed = o.failed();
     array.push_back(std::move(o));
@@ -308,17 +346,19 @@ Object parseArray(TokenParser& ts) {
       break;
     }
   }
-  if(ts.peek() == "]")
+  if(ts.peek() == TokenType::arrayEnd)
     ts.consume();
   return {Array{std::move(array), std::move(error)}};
 }
 
 Object parseDict(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "<<");
-  std::map<std::string, Object> dict{};
+  [[maybe_unused]] Token t = ts.read();
+  assert(t == TokenType::dictBegin);
+  Dictionary::Items dict{objectResource()};
   std::string error{};
-  while(ts.peek() != ">>") {
+  constexpr std::size_t seenMin = 16;
+  std::unordered_set<Symbol> seen{};
+  while(ts.peek() != TokenType::dictEnd) {
     Object oKey = readObject(ts);
     if(oKey.failed()) {
       error = "Error reading key" + report_position(ts);
@@ -328,36 +368,80 @@ Object parseDict(TokenParser& ts) {
       error = "Key not a name" + report_position(ts);
       break;
     }
-    std::string key = oKey.get<Name>();
-    if(dict.find(key) != dict.end()) {
-      error = "Duplicite key /" + key + report_position(ts);
+    const auto& name = oKey.get<Name>();
+    auto sym = name.symbol();
+    Symbol key = sym ? *sym : Symbol::intern(name);
+    // Large dictionaries (e.g., name trees) get a set for the duplicate check
+    if(dict.size() == seenMin)
+      for(const auto& kv : dict)
+        seen.insert(kv.first);
+    if(dict.size() < seenMin
+        ? std::any_of(dict.begin(), dict.end(), [key](const auto& kv) { return kv.first == key; })
+        : !seen.insert(key).second) {
+      error = "Duplicite key /" + std::string{key.str()} + report_position(ts);
       break;
     }
-    Object oVal = (ts.peek() == ">>")
+    Object oVal = (ts.peek() == TokenType::dictEnd)
       ? Object{Invalid{"Value not present" + report_position(ts)}}
       : readObject(ts);
     bool failed = oVal.failed();
-    dict.emplace(std::move(key), std::move(oVal));
+    dict.emplace_back(key, std::move(oVal));
     // Yes, we want to store the value even if parsing failed
     if(failed) {
       error = "Error reading value" + report_position(ts);
       break;
     }
   }
-  if(ts.peek() == ">>")
+  if(ts.peek() == TokenType::dictEnd)
     ts.consume();
   return {Dictionary{std::move(dict), std::move(error)}};
 }
 
 Object parseStream(TokenParser& ts, Dictionary&& dict) {
-  std::string s = ts.read();
-  assert(s == "stream");
+  stats::ScopedTimer timer{stats::Timer::parseStream};
+  [[maybe_unused]] Token t = ts.read();
+  assert(t == "stream");
   assert(ts.empty());
   std::streambuf& stream = *ts.stream();
   skipToLF(stream);
   std::string contents{};
   std::string error{};
-  if(auto oLen = dict.lookup("Length");
+  if(InputBuffer* mem = ts.memory()) {
+    std::string_view data = mem->remaining();
+    if(auto oLen = dict.lookup(names::Length);
+        oLen.is<Numeric>() && oLen.get<Numeric>().uintegral()) {
+      auto len = oLen.get<Numeric>().val_ulong();
+      if(len > data.length()) {
+        error = "End of input during reading stream data, read " + format_position(data.length()) + " bytes";
+        mem->seek(mem->end());
+      } else {
+        data = data.substr(0, len);
+        mem->seek(data.data() + len);
+        if(ts.read() != "endstream")
+          error = "endstream not found" + report_position(ts);
+      }
+    } else {
+      const std::string_view sep = "endstream";
+      if(auto off = findKeyword(data, sep); off != std::string_view::npos) {
+        mem->seek(data.data() + off + sep.length());
+        data = data.substr(0, off);
+      } else {
+        error = "End of input during reading stream data";
+        mem->seek(mem->end());
+      }
+      data = chopNL(data);
+    }
+    // Refer to the input directly if it's guaranteed to outlive us
+    if(mem->owner()) {
+      stats::add(stats::Counter::streamsReferenced);
+      stats::add(stats::Counter::streamBytesReferenced, data.length());
+      return {Stream{std::move(dict), data, mem->owner(), std::move(error)}};
+    } else {
+      stats::add(stats::Counter::streamsCopied);
+      stats::add(stats::Counter::streamBytesCopied, data.length());
+      return {Stream{std::move(dict), std::string{data}, std::move(error)}};
+    }
+  } else if(auto oLen = dict.lookup(names::Length);
       oLen.is<Numeric>() && oLen.get<Numeric>().uintegral()) {
     auto len = oLen.get<Numeric>().val_ulong();
     contents.resize(len);
@@ -367,6 +451,7 @@ Object parseStream(TokenParser& ts, Dictionary&& dict) {
       error = "endstream not found" + report_position(ts);
   } else {
     const std::string sep = "endstream";
+    std::string s;
     for(s = readToNL(stream); !s.empty(); s = readToNL(stream)) {
       /* We can't rely on this being the only thing on a line, especially
          if the file is possibly broken anyway. */
@@ -390,16 +475,19 @@ Object parseStream(TokenParser& ts, Dictionary&& dict) {
       error = "End of input during reading stream data";
     chopNL(std::move(contents));
   }
+  stats::add(stats::Counter::streamsCopied);
+  stats::add(stats::Counter::streamBytesCopied, contents.length());
   return {Stream{std::move(dict), std::move(contents), std::move(error)}};
 }
 
 /***** Top level object parsing *****/
 
 TopLevelObject parseNamedObject(TokenParser& ts) {
-  Numeric num{ts.read()};
+  Token first = ts.read();
+  Numeric num{first.text};
   if(!num.uintegral())
     return {Invalid{"Misshaped named object header (gen)" + report_position(ts)}};
-  Numeric gen{ts.read()};
+  Numeric gen{ts.read().text};
   if(!gen.uintegral())
     return {Invalid{"Misshaped named object header (gen)" + report_position(ts)}};
   if(ts.read() != "obj")
@@ -408,58 +496,74 @@ TopLevelObject parseNamedObject(TokenParser& ts) {
   if(contents.is<Dictionary>() && ts.peek() == "stream")
     contents = parseStream(ts, std::move(contents).get<Dictionary>());
   std::string error{};
-  if(std::string s = ts.read(); s != "endobj") {
-    if(s.empty())
+  Token t = ts.read();
+  if(t != "endobj") {
+    if(t.eof())
       error = "End of input where endobj expected";
     else
       error = "endobj not found" + report_position(ts);
+  } else if(const InputBuffer* mem = ts.input(); mem && mem->owner() && !contents.failed()) {
+    // Both tokens point into the input
+    const char* start = first.text.data();
+    const char* end = t.text.data() + t.text.length();
+    return {NamedObject{num.val_ulong(), gen.val_ulong(), std::move(contents),
+      std::string_view{start, static_cast<std::size_t>(end - start)}, mem->owner()}};
   }
   return {NamedObject{num.val_ulong(), gen.val_ulong(), std::move(contents),
     std::move(error)}};
 }
 
 TopLevelObject parseXRefTable(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "xref");
+  Token t = ts.read();
+  assert(t == "xref");
   assert(ts.empty());
   std::streambuf& stream = *ts.stream();
   skipToNL(stream);
+  // The implementation limit of PDF 1.7 (Annex C) on the number of objects
+  constexpr unsigned long maxCount = 8388608;
+  // Rows are read in pieces, so that a count beyond the end of the input doesn't allocate for it all
+  constexpr std::size_t pieceSize = 20 << 12;
   std::vector<XRefTable::Section> sections{};
   while(true) {
-    s = ts.peek();
-    if(s.empty()) // EOF
+    t = ts.peek();
+    if(t.eof())
       return {Invalid{"End of input while reading xref table"}};
-    else if(s == "trailer")
+    else if(t == "trailer")
       break;
     ts.consume();
-    Numeric start{s};
+    Numeric start{t.text};
     if(!start.uintegral())
       return {Invalid{"Broken xref subsection header (start)" + report_position(ts)}};
-    Numeric count{ts.read()};
-    if(!count.uintegral())
+    Numeric count{ts.read().text};
+    if(!count.uintegral() || count.val_ulong() > maxCount)
       return {Invalid{"Broken xref subsection header (count)" + report_position(ts)}};
     skipToNL(stream);
-    unsigned len = 20 * count.val_ulong();
-    s.resize(len);
-    if(stream.sgetn(s.data(), len) < len)
-      return {Invalid{"End of input while reading xref table"}};
-    sections.push_back({start.val_ulong(), count.val_ulong(), std::move(s)});
+    const std::size_t len = 20 * static_cast<std::size_t>(count.val_ulong());
+    std::string data{};
+    while(data.length() < len) {
+      std::size_t have = data.length();
+      std::size_t part = std::min(len - have, pieceSize);
+      data.resize(have + part);
+      if(static_cast<std::size_t>(stream.sgetn(data.data() + have, part)) < part)
+        return {Invalid{"End of input while reading xref table"}};
+    }
+    sections.push_back({start.val_ulong(), count.val_ulong(), std::move(data)});
   }
   return {XRefTable{std::move(sections)}};
 }
 
 TopLevelObject parseTrailer(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "trailer");
+  [[maybe_unused]] Token t = ts.read();
+  assert(t == "trailer");
   auto start = ts.lastpos();
   Object trailer = readObject(ts);
   return {Trailer{std::move(trailer), start}};
 }
 
 TopLevelObject parseStartXRef(TokenParser& ts) {
-  std::string s = ts.read();
-  assert(s == "startxref");
-  Numeric num{ts.read()};
+  [[maybe_unused]] Token t = ts.read();
+  assert(t == "startxref");
+  Numeric num{ts.read().text};
   if(!num.uintegral())
     return {Invalid{"Broken startxref" + report_position(ts)}};
   return {StartXRef{static_cast<std::streamoff>(num.val_ulong())}};
@@ -468,38 +572,46 @@ TopLevelObject parseStartXRef(TokenParser& ts) {
 /***** High level parsing *****/
 
 Object readObject(TokenParser& ts) {
-  std::string t = ts.peek();
-  if(t == "")
-    return {Invalid{"End of input"}};
-  else if(t == "/")
-    return parseName(ts);
-  else if(t == "(")
-    return parseStringLiteral(ts);
-  else if(t == "<")
-    return parseStringHex(ts);
-  else if(t == "<<")
-    return parseDict(ts);
-  else if(t == "[")
-    return parseArray(ts);
-  else if(t == "null") {
-    ts.consume();
-    return {Null{}};
-  } else if(t == "true" || t == "false") {
-    ts.consume();
-    return {Boolean{t == "true"}};
-  } else if(Numeric n1{t}; n1.valid()) {
-    ts.consume();
-    return parseNumberIndir(ts, std::move(n1));
-  } else {
-    return {Invalid{"Garbage or unexpected token" + report_position(ts)}};
+  Token t = ts.peek();
+  switch(t.type) {
+    case TokenType::eof:
+      return {Invalid{"End of input"}};
+    case TokenType::name:
+      return parseName(ts);
+    case TokenType::stringLit:
+      return parseStringLiteral(ts);
+    case TokenType::stringHex:
+      return parseStringHex(ts);
+    case TokenType::dictBegin:
+      return parseDict(ts);
+    case TokenType::arrayBegin:
+      return parseArray(ts);
+    case TokenType::regular:
+      if(t == "null") {
+        ts.consume();
+        return {Null{}};
+      } else if(t == "true" || t == "false") {
+        ts.consume();
+        return {Boolean{t == "true"}};
+      } else if(Numeric n1{t.text}; n1.valid()) {
+        ts.consume();
+        return parseNumberIndir(ts, std::move(n1));
+      } else
+        return {Invalid{"Garbage or unexpected token" + report_position(ts)}};
+    default:
+      return {Invalid{"Garbage or unexpected token" + report_position(ts)}};
   }
 }
 
-TopLevelObject readTopLevelObject(TokenParser& ts) {
-  std::string t = ts.peek();
-  if(t == "") // EOF
+namespace {
+
+TopLevelObject parseTopLevelObject(TokenParser& ts) {
+  Token t = ts.peek();
+  if(t.eof())
     return {Null{}};
-  else if(Numeric{t}.uintegral())
+  else if(t != TokenType::regular)
+    return {Invalid{"Garbage or unexpected token" + report_position(ts)}};
+  else if(Numeric{t.text}.uintegral())
     return parseNamedObject(ts);
   else if(t == "xref")
     return parseXRefTable(ts);
@@ -511,17 +623,78 @@ TopLevelObject readTopLevelObject(TokenParser& ts) {
     return {Invalid{"Garbage or unexpected token" + report_position(ts)}};
 }
 
+// Counts top-level objects by kind, and named objects by their contents.
+void countTopLevelObject([[maybe_unused]] const TopLevelObject& tlo) {
+#ifdef PDF_STATS
+  using stats::Counter;
+  auto kind = tlo.is<NamedObject>() ? Counter::namedObjects
+    : tlo.is<XRefTable>() ? Counter::xrefTables
+    : tlo.is<Trailer>() ? Counter::trailers
+    : tlo.is<StartXRef>() ? Counter::startXRefs
+    : tlo.is<Invalid>() ? Counter::invalidTopLevel
+    : Counter::count_;
+  if(kind == Counter::count_) // EOF
+    return;
+  stats::add(kind);
+  if(!tlo.is<NamedObject>())
+    return;
+  const Object& obj = tlo.get<NamedObject>().object();
+  stats::add(obj.is<Null>() ? Counter::nulls
+    : obj.is<Boolean>() ? Counter::booleans
+    : obj.is<Numeric>() ? Counter::numerics
+    : obj.is<String>() ? Counter::strings
+    : obj.is<Name>() ? Counter::names
+    : obj.is<Array>() ? Counter::arrays
+    : obj.is<Dictionary>() ? Counter::dictionaries
+    : obj.is<Stream>() ? Counter::streams
+    : obj.is<Indirect>() ? Counter::indirects
+    : Counter::invalidContents);
+#endif
+}
+
+} // anonymous namespace
+
+TopLevelObject readTopLevelObject(TokenParser& ts) {
+  stats::ScopedTimer timer{stats::Timer::parse};
+  TopLevelObject tlo = parseTopLevelObject(ts);
+  countTopLevelObject(tlo);
+  return tlo;
+}
+
 bool skipToEndobj(std::streambuf& stream) {
   const std::string sep = "endobj";
-  for(std::string s = readToNL(stream); !s.empty(); s = readToNL(stream)) {
-    if(auto off = s.find(sep); off != std::string::npos) {
-      if(off + sep.length() == s.length()) // separator at end of line: OK
-        return true;
-      stream.pubseekoff(- s.length() + off + sep.length(), std::ios_base::cur);
-      if(char after = std::streambuf::traits_type::to_char_type(stream.sgetc());
-          charType(after) != CharType::regular)
+  if(auto mem = dynamic_cast<InputBuffer*>(&stream)) {
+    std::string_view data = mem->remaining();
+    if(auto off = findKeyword(data, sep); off != std::string_view::npos) {
+      mem->seek(data.data() + off + sep.length());
+      return true;
+    } else {
+      mem->seek(mem->end());
+      return false;
+    }
+  }
+  // Read in blocks, keeping enough of the previous one for a match across the boundary
+  constexpr std::size_t blockSize = 64 << 10;
+  std::string window{};
+  std::vector<char> block(blockSize);
+  bool eof = false;
+  while(!eof) {
+    auto len = stream.sgetn(block.data(), block.size());
+    eof = len < static_cast<std::streamsize>(block.size());
+    window.append(block.data(), len);
+    const char* begin = window.data();
+    const char* end = begin + window.length();
+    for(const char* ptr = parser::findKeyword(begin, end, sep); ptr != end; ptr = parser::findKeyword(ptr + 1, end, sep)) {
+      const char* after = ptr + sep.length();
+      if(after == end && !eof)
+        break; // decided by the next block
+      if(after == end || charType(*after) != CharType::regular) {
+        stream.pubseekoff(after - end, std::ios_base::cur);
         return true;
+      }
     }
+    if(window.length() > sep.length())
+      window.erase(0, window.length() - sep.length());
   }
   return false;
 }
@@ -1,58 +1,96 @@
 #ifndef PDF_PARSER_H
 #define PDF_PARSER_H
 
-#include <stack>
+#include <array>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <istream>
 #include <cassert>
 
 #include "pdfbase.h"
 #include "pdffile.h"
+#include "pdfinput.h"
+#include "pdfscan.h"
+#include "pdfstats.h"
 
 namespace pdf {
 
 namespace parser {
 
+enum class TokenType {
+  eof,
+  name,       // "/"
+  stringLit,  // "("
+  stringHex,  // "<"
+  dictBegin,  // "<<"
+  dictEnd,    // ">>"
+  arrayBegin, // "["
+  arrayEnd,   // "]"
+  delim,      // any other delimiter
+  regular
+};
+
+/* A token is only a view of its text, which lives either in the input
+   buffer or in the TokenParser's scratch space. In the latter case it stays
+   valid while at least two more tokens are read from the underlying stream. */
+struct Token {
+  TokenType type;
+  std::string_view text;
+
+  bool eof() const { return type == TokenType::eof; }
+  bool operator== (std::string_view str) const { return text == str; }
+  bool operator!= (std::string_view str) const { return text != str; }
+  bool operator== (TokenType type_) const { return type == type_; }
+  bool operator!= (TokenType type_) const { return type != type_; }
+};
+
 class TokenParser {
   std::streambuf* _stream;
-  std::stack<std::string> _stack;
+  InputBuffer* _mem; // == _stream if it's an in-memory buffer, nullptr otherwise
+  // "n g R" needs two tokens of lookahead, no construct needs more
+  std::array<Token, 2> _ahead;
+  unsigned _count;
   std::size_t _lastLen;
+  // Storage of token text if not reading from memory
+  std::array<std::string, 3> _scratch;
+  unsigned _scratchIx;
 
   public:
-  TokenParser(std::streambuf* stream_) : _stream{stream_}, _stack{}, _lastLen{0} { }
+  TokenParser(std::streambuf* stream_)
+    : _stream{stream_}, _mem{dynamic_cast<InputBuffer*>(stream_)},
+      _ahead{}, _count{0}, _lastLen{0}, _scratch{}, _scratchIx{0} { }
 
   ~TokenParser() {
-    assert(_stack.size() <= 1);
-    if(_stack.size() > 0)
+    assert(_count <= 1);
+    if(_count > 0)
       _stream->pubseekoff(-_lastLen, std::ios_base::cur);
   }
 
-  std::string read() {
-    if(!_stack.empty()) {
-      auto ret = _stack.top();
-      _stack.pop();
-      return ret;
-    } else
-      return underflow();
+  Token read() {
+    if(_count > 0)
+      return _ahead[--_count];
+    else
+      return next();
   }
 
   void consume() {
     read();
   }
 
-  void unread(std::string t) {
-    _stack.push(std::move(t));
+  void unread(Token t) {
+    assert(_count < _ahead.size());
+    _ahead[_count++] = t;
   }
 
-  std::string peek() {
-    if(_stack.empty())
-      _stack.push(underflow());
-    return _stack.top();
+  Token peek() {
+    if(_count == 0)
+      _ahead[_count++] = next();
+    return _ahead[_count - 1];
   }
 
   bool empty() const {
-    return _stack.empty();
+    return _count == 0;
   }
 
   std::streambuf* stream() {
@@ -61,18 +99,34 @@ class TokenParser {
     return _stream;
   }
 
+  // Non-null if the underlying stream can be accessed directly in memory.
+  InputBuffer* memory() {
+    assert(empty());
+    reset();
+    return _mem;
+  }
+
+  // Like memory(), but leaves any lookahead alone. Tokens read from memory
+  // refer to it, so their position in the input is known.
+  const InputBuffer* input() const {
+    return _mem;
+  }
+
   void newstream(std::streambuf* stream_) {
     _stream = stream_;
+    _mem = dynamic_cast<InputBuffer*>(stream_);
     reset();
   }
 
   // Always call after manipulating the underlying stream.
   void reset() {
-    _stack = {};
+    _count = 0;
     _lastLen = 0;
   }
 
   std::streamoff pos() const {
+    if(_mem)
+      return _mem->offset(_mem->cur());
     std::streamoff offset = _stream->pubseekoff(0, std::ios_base::cur);
     if(offset == (decltype(offset))(-1))
       throw std::logic_error("Can't determine position in provided stream");
@@ -84,16 +138,16 @@ class TokenParser {
   }
 
   private:
-  std::string underflow();
-};
+  Token next() {
+    Token t = underflow();
+    stats::add(stats::Counter::tokens);
+    stats::add(stats::Counter::tokenBytes, t.text.length());
+    return t;
+  }
 
-enum class CharType {
-  ws,
-  delim,
-  regular
+  Token underflow();
 };
 
-CharType charType(char c);
 std::string readLine(std::streambuf& stream);
 
 Object parseName(TokenParser& ts);
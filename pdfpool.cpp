@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <utility>
+
+#include "pdfpool.h"
+
+namespace pdf {
+
+namespace {
+
+// The pool whose worker is running on this thread, if any
+thread_local const WorkerPool* currentPool = nullptr;
+
+} // anonymous namespace
+
+WorkerPool::WorkerPool(unsigned threads, std::size_t maxQueued)
+  : _threads{}, _queue{}, _maxQueued{std::max<std::size_t>(maxQueued, 1)},
+    _running{0}, _stop{false}, _error{}
+{
+  for(unsigned i = 0; i < threads; i++)
+    _threads.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::unique_lock lock{_mutex};
+    _cvIdle.wait(lock, [this] { return _queue.empty() && _running == 0; });
+    _stop = true;
+  }
+  _cvJob.notify_all();
+  for(auto& thread : _threads)
+    thread.join();
+}
+
+void WorkerPool::submit(std::function<void()> job) {
+  if(_threads.empty()) {
+    job();
+    return;
+  }
+  {
+    std::unique_lock lock{_mutex};
+    if(currentPool == this && _queue.size() >= _maxQueued) {
+      // All workers could be waiting here
+      lock.unlock();
+      job();
+      return;
+    }
+    _cvRoom.wait(lock, [this] { return _queue.size() < _maxQueued || _error; });
+    rethrow();
+    _queue.push_back(std::move(job));
+  }
+  _cvJob.notify_one();
+}
+
+void WorkerPool::wait() {
+  std::unique_lock lock{_mutex};
+  _cvIdle.wait(lock, [this] { return _queue.empty() && _running == 0; });
+  rethrow();
+}
+
+// Call with _mutex locked
+void WorkerPool::rethrow() {
+  if(_error)
+    std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void WorkerPool::work() {
+  currentPool = this;
+  std::unique_lock lock{_mutex};
+  while(true) {
+    _cvJob.wait(lock, [this] { return !_queue.empty() || _stop; });
+    if(_queue.empty())
+      return; // _stop
+    auto job = std::move(_queue.front());
+    _queue.pop_front();
+    ++_running;
+    lock.unlock();
+    _cvRoom.notify_one();
+    std::exception_ptr error{};
+    try {
+      job();
+    } catch(...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    --_running;
+    if(error && !_error)
+      _error = error;
+    if(error)
+      _cvRoom.notify_all();
+    if(_queue.empty() && _running == 0)
+      _cvIdle.notify_all();
+  }
+}
+
+} // namespace pdf
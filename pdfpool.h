@@ -0,0 +1,49 @@
+#ifndef PDF_POOL_H
+#define PDF_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pdf {
+
+/* A fixed set of worker threads executing submitted jobs in FIFO order.
+   At most maxQueued jobs may be waiting; submit() blocks until there is
+   room, which bounds the memory held by pending jobs. With zero threads,
+   jobs are executed directly in submit(). Jobs may submit more jobs; if
+   the queue is full then, the new job runs right away in the submitting
+   worker instead of waiting, which could deadlock. If a job throws, the
+   first exception is rethrown by wait() or the next submit(). */
+class WorkerPool {
+  std::vector<std::thread> _threads;
+  std::deque<std::function<void()>> _queue;
+  std::size_t _maxQueued;
+  std::size_t _running;
+  bool _stop;
+  std::exception_ptr _error;
+  std::mutex _mutex;
+  std::condition_variable _cvJob, _cvRoom, _cvIdle;
+
+  public:
+  WorkerPool(unsigned threads, std::size_t maxQueued);
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  ~WorkerPool();
+
+  std::size_t threads() const { return _threads.size(); }
+
+  void submit(std::function<void()> job);
+  void wait();
+
+  private:
+  void work();
+  void rethrow();
+};
+
+} // namespace pdf
+
+#endif
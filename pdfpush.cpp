@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <istream>
+
+#include "pdfpush.h"
+#include "pdfparser.h"
+#include "pdfscan.h"
+
+namespace pdf::parser {
+
+namespace {
+
+// Keywords after which an object may have become complete
+constexpr std::string_view terminators[] = {"endobj", "trailer", "startxref", "%%EOF"};
+constexpr std::size_t maxTerminator = 9;
+// Retrying after a terminator needs the pending data to grow by 1/minGrowth
+constexpr std::size_t minGrowth = 4;
+
+/* Whether data contains "endobj" as skipToEndObj would find it, followed
+   by a byte that shows it's not part of a longer token. */
+bool hasEndObj(std::string_view data) {
+  const std::string_view sep = "endobj";
+  const char* end = data.data() + data.length();
+  for(const char* ptr = findKeyword(data.data(), end, sep); ptr != end; ptr = findKeyword(ptr + 1, end, sep))
+    if(const char* after = ptr + sep.length(); after != end && charType(*after) != CharType::regular)
+      return true;
+  return false;
+}
+
+/* The window as parsed, noting how far the parser looked: the token
+   parser steps back over a token of lookahead when it's done, and reads
+   that ran into the end of the window go through underflow(). */
+class WindowBuffer : public InputBuffer {
+  const char* _reach;
+
+  public:
+  WindowBuffer(std::string_view data_, std::shared_ptr<const void> owner_, std::streamoff base_)
+    : InputBuffer(data_, std::move(owner_), base_), _reach(begin()) { }
+
+  bool reachedEnd() const { return std::max(_reach, cur()) == end(); }
+
+  protected:
+  int_type underflow() override {
+    _reach = end();
+    return traits_type::eof();
+  }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+    _reach = std::max(_reach, cur());
+    return InputBuffer::seekoff(off, dir, which);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    _reach = std::max(_reach, cur());
+    return InputBuffer::seekpos(pos, which);
+  }
+};
+
+} // anonymous namespace
+
+PushParser::PushParser(std::streamoff start)
+  : _window{std::make_shared<std::string>()}, _pos{0}, _base{start}, _tried{0},
+    _finished{false}, _done{false} { }
+
+void PushParser::feed(std::string_view chunk) {
+  if(_window.use_count() == 1) {
+    // Nothing refers to the window, so it can be reused. Dropping the parsed
+    // part only when it's most of it keeps the copying linear.
+    if(_pos > 0 && _pos >= _window->length() / 2) {
+      _window->erase(0, _pos);
+      _base += _pos;
+      _tried -= std::min(_tried, _pos);
+      _pos = 0;
+    }
+    _window->append(chunk);
+  } else {
+    // Parsed objects still point into the window, start a new one
+    auto window = std::make_shared<std::string>();
+    window->reserve(_window->length() - _pos + chunk.length());
+    window->append(*_window, _pos);
+    window->append(chunk);
+    _base += _pos;
+    _tried -= std::min(_tried, _pos);
+    _pos = 0;
+    _window = std::move(window);
+  }
+}
+
+void PushParser::finish() {
+  _finished = true;
+}
+
+bool PushParser::worthRetry() const {
+  if(_finished || _tried == 0)
+    return true;
+  // An object that was incomplete is rarely finished unless one of these
+  // arrived. Doubling ensures progress in any case. A damaged object can
+  // swallow many terminators, so those need some growth too to keep the
+  // retries linear in total.
+  const std::string_view data{*_window};
+  if(data.length() - _pos >= 2 * (_tried - _pos))
+    return true;
+  if(data.length() - _tried < (_tried - _pos) / minGrowth)
+    return false;
+  std::string_view added = data.substr(std::max(_pos, _tried >= maxTerminator ? _tried - maxTerminator : 0));
+  const char* end = added.data() + added.length();
+  for(auto keyword : terminators)
+    if(findKeyword(added.data(), end, keyword) != end)
+      return true;
+  return false;
+}
+
+std::optional<ParsedObject> PushParser::next() {
+  if(_done || !worthRetry())
+    return {};
+  const std::string_view data{*_window};
+  WindowBuffer buf{data, _window, _base};
+  buf.seek(buf.begin() + _pos);
+  std::istream is{&buf};
+  std::streamoff start = buf.offset(buf.cur());
+  TopLevelObject tlo{};
+  is >> tlo;
+  if(is.eof()) {
+    // Only whitespace and comments, of which more may follow
+    if(_finished)
+      _done = true;
+    else
+      _tried = data.length();
+    return {};
+  }
+  is.clear();
+  const char* stop = buf.cur();
+  // The parser's view of the input may change with more data if it reached
+  // the end, on success or failure. Errors are only final once there's an
+  // endobj to recover at.
+  bool complete = _finished
+    || (!buf.reachedEnd() && (!tlo.failed() || hasEndObj({stop, static_cast<std::size_t>(buf.end() - stop)})));
+  if(!complete) {
+    _tried = data.length();
+    return {};
+  }
+  _tried = 0;
+  bool recovered = true;
+  if(tlo.is<Invalid>()) {
+    recovered = static_cast<bool>(is >> skipToEndObj);
+    is.clear();
+  }
+  ParsedObject ret{start, buf.offset(buf.cur()), std::move(tlo), recovered};
+  _pos = buf.cur() - buf.begin();
+  if(!recovered)
+    _done = true;
+  return ret;
+}
+
+} // namespace pdf::parser
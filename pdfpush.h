@@ -0,0 +1,48 @@
+#ifndef PDF_PUSH_H
+#define PDF_PUSH_H
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "pdfsplit.h"
+
+namespace pdf::parser {
+
+/* Parses input that arrives in chunks, e.g., from a pipe or a socket,
+   without ever seeking in it. Chunks are appended to an internal window by
+   feed(); next() returns each top-level object as soon as the window holds
+   all of it, with offsets counted from the start of the whole input. The
+   objects are the same as those of parseRange() over the complete input.
+   Parsed objects may refer to the window (stream data, source bytes), the
+   memory stays valid for as long as they exist. */
+class PushParser {
+  std::shared_ptr<std::string> _window;
+  std::size_t _pos;       // start of the unparsed part of _window
+  std::streamoff _base;   // offset of _window in the input
+  std::size_t _tried;     // size of _window when parsing last ran out of input
+  bool _finished;
+  bool _done;
+
+  public:
+  PushParser(std::streamoff start = 0);
+
+  void feed(std::string_view chunk);
+  // Marks the end of input, everything remaining can be parsed.
+  void finish();
+
+  // Returns nothing if more input is needed, or the input is exhausted.
+  std::optional<ParsedObject> next();
+  // True after next() has returned all objects of a finished input.
+  bool done() const { return _done; }
+  // Position of the first byte not parsed yet.
+  std::streamoff offset() const { return _base + _pos; }
+
+  private:
+  bool worthRetry() const;
+};
+
+} // namespace pdf::parser
+
+#endif
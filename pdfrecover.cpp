@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "pdfrecover.h"
+#include "pdfscan.h"
+
+namespace pdf::parser {
+
+namespace {
+
+bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool isRegular(char c) {
+  return charType(c) == CharType::regular;
+}
+
+bool isWS(char c) {
+  return charType(c) == CharType::ws;
+}
+
+// Given the header ends right before pos, parses backwards "num ws gen ws".
+bool matchHeader(const char* begin, const char* pos, RecoveryScan::Candidate& cand) {
+  auto skip = [begin](const char*& ptr, auto pred) {
+    const char* start = ptr;
+    while(ptr != begin && pred(ptr[-1]))
+      --ptr;
+    return ptr != start;
+  };
+  const char* ptr = pos;
+  if(!skip(ptr, isWS))
+    return false;
+  const char* genEnd = ptr;
+  if(!skip(ptr, isDigit))
+    return false;
+  const char* genStart = ptr;
+  if(!skip(ptr, isWS))
+    return false;
+  const char* numEnd = ptr;
+  if(!skip(ptr, isDigit))
+    return false;
+  if(ptr != begin && !isWS(ptr[-1]))
+    return false;
+  // Numbers too large for an object header aren't one
+  auto parse = [](const char* from, const char* to, unsigned long max, unsigned long& ret) {
+    ret = 0;
+    for(; from != to; ++from) {
+      unsigned long digit = *from - '0';
+      if(ret > (max - digit) / 10)
+        return false;
+      ret = ret * 10 + digit;
+    }
+    return true;
+  };
+  cand.offset = ptr - begin;
+  return parse(ptr, numEnd, std::numeric_limits<unsigned long>::max(), cand.num)
+    && parse(genStart, genEnd, 65535, cand.gen);
+}
+
+} // anonymous namespace
+
+RecoveryScan::RecoveryScan(std::string_view data) : _found{}, _cursor{} {
+  constexpr std::string_view keywords[] = {"obj", "xref", "trailer"};
+  const char* begin = data.data();
+  const char* end = begin + data.length();
+  auto add = [this](Kind kind, Candidate cand) { _found[static_cast<std::size_t>(kind)].push_back(cand); };
+  auto precededBy = [begin](const char* ptr, std::string_view str) {
+    return static_cast<std::size_t>(ptr - begin) >= str.length()
+      && std::memcmp(ptr - str.length(), str.data(), str.length()) == 0;
+  };
+  std::size_t which;
+  for(const char* ptr = findKeywords(begin, end, keywords, std::size(keywords), which); ptr != end;
+      ptr = findKeywords(ptr + 1, end, keywords, std::size(keywords), which)) {
+    const char* after = ptr + keywords[which].length();
+    // All must be followed by a delimiter, whitespace or the end
+    if(after != end && isRegular(*after))
+      continue;
+    bool delimBefore = ptr == begin || !isRegular(ptr[-1]);
+    switch(which) {
+      case 0: // obj
+        if(precededBy(ptr, "end"))
+          add(Kind::endobj, {ptr - 3 - begin, 0, 0});
+        else if(Candidate cand; matchHeader(begin, ptr, cand))
+          add(Kind::object, cand);
+        break;
+      case 1: // xref
+        if(precededBy(ptr, "start")) {
+          if(ptr - 5 == begin || !isRegular(ptr[-6]))
+            add(Kind::startxref, {ptr - 5 - begin, 0, 0});
+        } else if(delimBefore)
+          add(Kind::xref, {ptr - begin, 0, 0});
+        break;
+      case 2: // trailer
+        if(delimBefore)
+          add(Kind::trailer, {ptr - begin, 0, 0});
+        break;
+    }
+  }
+}
+
+const RecoveryScan::Candidate* RecoveryScan::next(Kind kind, std::streamoff from) const {
+  const auto& list = _found[static_cast<std::size_t>(kind)];
+  std::size_t& ix = _cursor[static_cast<std::size_t>(kind)];
+  auto before = [](const Candidate& cand, std::streamoff off) { return cand.offset < off; };
+  if(ix > 0 && list[ix - 1].offset >= from)
+    // Moved backwards
+    ix = std::lower_bound(list.begin(), list.begin() + ix, from, before) - list.begin();
+  else {
+    // Usually the answer is among the next few
+    constexpr std::size_t maxSteps = 8;
+    for(std::size_t i = 0; i < maxSteps && ix < list.size() && list[ix].offset < from; i++)
+      ix++;
+    if(ix < list.size() && list[ix].offset < from)
+      ix = std::lower_bound(list.begin() + ix, list.end(), from, before) - list.begin();
+  }
+  return ix < list.size() ? &list[ix] : nullptr;
+}
+
+bool RecoveryScan::skipToEndObj(InputBuffer& input) const {
+  const char* begin = input.data().data();
+  if(const Candidate* cand = next(Kind::endobj, input.cur() - begin)) {
+    input.seek(begin + cand->offset + 6);
+    return true;
+  } else {
+    input.seek(input.end());
+    return false;
+  }
+}
+
+} // namespace pdf::parser
@@ -0,0 +1,55 @@
+#ifndef PDF_RECOVER_H
+#define PDF_RECOVER_H
+
+#include <array>
+#include <string_view>
+#include <vector>
+
+#include "pdfinput.h"
+
+namespace pdf::parser {
+
+/* Locations of everything in a file that looks like the start or end of a
+   top-level object, found in a single pass. Used to resume reading after
+   an error without scanning again, and to rebuild a broken xref table.
+   Like findObjHeader(), it may find matches inside stream data. */
+class RecoveryScan {
+  public:
+  enum class Kind {
+    object,    // "num gen obj"
+    endobj,    // as found by skipToEndObj
+    xref,
+    trailer,
+    startxref
+  };
+  static constexpr std::size_t kinds = 5;
+
+  struct Candidate {
+    std::streamoff offset;  // offset of the keyword or the object header
+    unsigned long num;      // object: object number
+    unsigned long gen;      // object: generation number
+  };
+
+  private:
+  std::array<std::vector<Candidate>, kinds> _found;
+  mutable std::array<std::size_t, kinds> _cursor;
+
+  public:
+  RecoveryScan(std::string_view data);
+
+  // All candidates of a kind, in file order.
+  const std::vector<Candidate>& all(Kind kind) const { return _found[static_cast<std::size_t>(kind)]; }
+
+  /* First candidate of a kind at or after from, or nullptr. Successive
+     calls with growing from are cheap, typically a few steps from the
+     previous answer. */
+  const Candidate* next(Kind kind, std::streamoff from) const;
+
+  /* Same as skipToEndobj() on the input the scan was made of: seeks past
+     the next endobj, or to the end and returns false. */
+  bool skipToEndObj(InputBuffer& input) const;
+};
+
+} // namespace pdf::parser
+
+#endif
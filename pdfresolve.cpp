@@ -0,0 +1,177 @@
+#include <charconv>
+#include <limits>
+
+#include "pdfresolve.h"
+
+namespace pdf {
+
+const Object& Resolver::resolve(const Object& obj) {
+  return obj.is<Indirect>() ? resolve(obj.get<Indirect>().ref()) : obj;
+}
+
+const Object& Resolver::resolve(ObjRef ref) {
+  static const Object null{};
+  const TopLevelObject& tlo = _doc.load(ref);
+  return tlo.is<NamedObject>() ? tlo.get<NamedObject>().object() : null;
+}
+
+const std::vector<ObjRef>& Resolver::pages() {
+  if(_walked)
+    return _pages;
+  const Object& trailer = _doc.trailer();
+  const Object& root = trailer.is<Dictionary>() ? resolve(trailer.get<Dictionary>().lookup(names::Root)) : trailer;
+  if(!root.is<Dictionary>())
+    throw document_error("No /Root in trailer");
+  const Object& top = root.get<Dictionary>().lookup(names::Pages);
+  if(!top.is<Indirect>())
+    throw document_error("No /Pages in catalog");
+  // Nodes with their parents, the top one is its own
+  std::vector<std::pair<ObjRef, ObjRef>> stack{{top.get<Indirect>().ref(), top.get<Indirect>().ref()}};
+  while(!stack.empty()) {
+    auto [ref, parent] = stack.back();
+    stack.pop_back();
+    if(!_nodes.insert(ref).second)
+      continue;
+    if(!(ref == parent))
+      _parent.emplace(ref, parent);
+    const Object& node = resolve(ref);
+    if(!node.is<Dictionary>())
+      continue;
+    const Object& kids = node.get<Dictionary>().lookup(names::Kids);
+    if(!kids.is<Array>()) {
+      _pages.push_back(ref);
+      continue;
+    }
+    const auto& items = kids.get<Array>().items();
+    for(auto it = items.rbegin(); it != items.rend(); it++)
+      if(it->is<Indirect>())
+        stack.emplace_back(it->get<Indirect>().ref(), ref);
+  }
+  _walked = true;
+  return _pages;
+}
+
+bool Resolver::inPageTree(ObjRef ref) {
+  pages();
+  return _nodes.count(ref) != 0;
+}
+
+std::vector<ObjRef> Resolver::ancestors(ObjRef ref) {
+  pages();
+  std::vector<ObjRef> ret{};
+  // Parents are recorded before their children, so this ends at the top
+  for(auto it = _parent.find(ref); it != _parent.end(); it = _parent.find(it->second))
+    ret.push_back(it->second);
+  return ret;
+}
+
+std::vector<ObjRef> Resolver::reachable(const std::vector<ObjRef>& roots,
+    const std::function<bool(ObjRef, const TopLevelObject&)>& enter) {
+  std::vector<ObjRef> ret{};
+  std::set<ObjRef> seen{};
+  std::vector<ObjRef> stack{roots.rbegin(), roots.rend()};
+  std::vector<ObjRef> refs{};
+  while(!stack.empty()) {
+    ObjRef ref = stack.back();
+    stack.pop_back();
+    if(!seen.insert(ref).second)
+      continue;
+    const TopLevelObject& tlo = _doc.load(ref);
+    if(tlo.is<Null>() || (enter && !enter(ref, tlo)))
+      continue;
+    ret.push_back(ref);
+    if(!tlo.is<NamedObject>())
+      continue;
+    refs.clear();
+    references(tlo.get<NamedObject>().object(), refs);
+    stack.insert(stack.end(), refs.rbegin(), refs.rend());
+  }
+  return ret;
+}
+
+std::vector<ObjRef> Resolver::pageObjects(std::size_t index) {
+  const auto& list = pages();
+  if(index >= list.size())
+    return {};
+  const ObjRef page = list[index];
+  std::vector<ObjRef> roots{page};
+  const Dictionary& dict = resolve(page).get<Dictionary>();
+  // Inheritable attributes come from the nearest node that has them
+  for(Symbol key : {names::Resources, names::MediaBox, names::CropBox, names::Rotate}) {
+    if(dict.lookup(key))
+      continue;
+    for(ObjRef node : ancestors(page))
+      if(const Object& parent = resolve(node); parent.is<Dictionary>())
+        if(const Object& val = parent.get<Dictionary>().lookup(key)) {
+          references(val, roots);
+          break;
+        }
+  }
+  return reachable(roots, [this, page](ObjRef ref, const TopLevelObject&) {
+    return ref == page || !inPageTree(ref);
+  });
+}
+
+void Resolver::references(const Object& obj, std::vector<ObjRef>& refs) {
+  std::vector<const Object*> stack{&obj};
+  auto pushItems = [&stack](const Dictionary& dict) {
+    for(auto it = dict.items().rbegin(); it != dict.items().rend(); it++)
+      stack.push_back(&it->second);
+  };
+  while(!stack.empty()) {
+    const Object& cur = *stack.back();
+    stack.pop_back();
+    if(cur.is<Indirect>())
+      refs.push_back(cur.get<Indirect>().ref());
+    else if(cur.is<Array>()) {
+      const auto& items = cur.get<Array>().items();
+      for(auto it = items.rbegin(); it != items.rend(); it++)
+        stack.push_back(&*it);
+    } else if(cur.is<Dictionary>())
+      pushItems(cur.get<Dictionary>());
+    else if(cur.is<Stream>())
+      pushItems(cur.get<Stream>().dict());
+  }
+}
+
+/***** Page ranges *****/
+
+std::optional<std::vector<PageRange>> parsePageRanges(std::string_view str) {
+  std::vector<PageRange> ret{};
+  auto number = [&str](std::size_t& val) {
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.length(), val);
+    if(ec != std::errc{} || val == 0)
+      return false;
+    str.remove_prefix(ptr - str.data());
+    return true;
+  };
+  while(true) {
+    PageRange range{};
+    if(!number(range.first))
+      return {};
+    range.last = range.first;
+    if(!str.empty() && str.front() == '-') {
+      str.remove_prefix(1);
+      if(str.empty() || str.front() == ',')
+        range.last = std::numeric_limits<std::size_t>::max();
+      else if(!number(range.last) || range.last < range.first)
+        return {};
+    }
+    ret.push_back(range);
+    if(str.empty())
+      return ret;
+    if(str.front() != ',')
+      return {};
+    str.remove_prefix(1);
+  }
+}
+
+std::vector<std::size_t> selectPages(const std::vector<PageRange>& ranges, std::size_t count) {
+  std::vector<std::size_t> ret{};
+  for(const auto& range : ranges)
+    for(std::size_t page = range.first; page <= range.last && page <= count; page++)
+      ret.push_back(page - 1);
+  return ret;
+}
+
+} // namespace pdf
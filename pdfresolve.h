@@ -0,0 +1,73 @@
+#ifndef PDF_RESOLVE_H
+#define PDF_RESOLVE_H
+
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <string_view>
+#include <vector>
+
+#include "pdfbase.h"
+#include "pdfdocument.h"
+
+namespace pdf {
+
+/* Follows indirect references through a Document. Objects are loaded only
+   when a reference to them is followed, so walking the page tree or one
+   page's resources leaves the rest of the file unparsed. The walks are
+   iterative and visit every object once; cycles are harmless. */
+class Resolver {
+  Document& _doc;
+  // Filled by the first call to pages()
+  bool _walked;
+  std::vector<ObjRef> _pages;
+  std::set<ObjRef> _nodes;
+  std::map<ObjRef, ObjRef> _parent; // as found in /Kids, the first time
+
+  public:
+  Resolver(Document& doc_) : _doc(doc_), _walked(false), _pages{}, _nodes{}, _parent{} { }
+
+  // obj itself, or what it refers to. Null for missing or broken objects.
+  const Object& resolve(const Object& obj);
+  const Object& resolve(ObjRef ref);
+
+  /* The leaves of the page tree under /Root /Pages, in document order.
+     Nodes with /Kids are intermediate, anything else is a page. Throws
+     document_error if there's no page tree at all. */
+  const std::vector<ObjRef>& pages();
+  // Whether ref is a page or an intermediate node found by pages().
+  bool inPageTree(ObjRef ref);
+  // The intermediate nodes above a page (or node), nearest first.
+  std::vector<ObjRef> ancestors(ObjRef ref);
+
+  /* All objects reachable from roots, each once, in depth-first order;
+     references to objects that don't exist are dropped, broken
+     ones are listed but not followed. Objects for which enter returns
+     false are neither listed nor followed. */
+  std::vector<ObjRef> reachable(const std::vector<ObjRef>& roots,
+      const std::function<bool(ObjRef, const TopLevelObject&)>& enter = {});
+
+  /* What's needed to render one page of pages(): the page, whatever it
+     refers to, and the attributes it inherits from its ancestors, but no
+     other part of the page tree, e.g., through /Parent or links. */
+  std::vector<ObjRef> pageObjects(std::size_t index);
+
+  // Appends the references in obj, including nested direct objects, in order.
+  static void references(const Object& obj, std::vector<ObjRef>& refs);
+};
+
+/* A list of 1-based page numbers as in "1-3,7,10-": single pages, ranges,
+   and ranges open at the end. */
+struct PageRange {
+  std::size_t first;
+  std::size_t last; // inclusive, SIZE_MAX if open
+};
+
+std::optional<std::vector<PageRange>> parsePageRanges(std::string_view str);
+// 0-based indices of the pages given, in that order, of count pages.
+std::vector<std::size_t> selectPages(const std::vector<PageRange>& ranges, std::size_t count);
+
+} // namespace pdf
+
+#endif
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "pdfscan.h"
+
+namespace pdf::parser {
+
+namespace {
+
+#if defined(__AVX2__)
+#define PDF_SCAN_SIMD
+
+struct Simd {
+  using vec = __m256i;
+  static constexpr std::size_t width = 32;
+  static constexpr unsigned shift = 0; // log2(mask bits per byte)
+
+  static vec load(const char* ptr) { return _mm256_loadu_si256(reinterpret_cast<const vec*>(ptr)); }
+  static vec eq(vec v, char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); }
+  static vec or_(vec a, vec b) { return _mm256_or_si256(a, b); }
+  static vec and_(vec a, vec b) { return _mm256_and_si256(a, b); }
+  static std::uint64_t mask(vec v) { return static_cast<std::uint32_t>(_mm256_movemask_epi8(v)); }
+};
+
+#elif defined(__SSE2__)
+#define PDF_SCAN_SIMD
+
+struct Simd {
+  using vec = __m128i;
+  static constexpr std::size_t width = 16;
+  static constexpr unsigned shift = 0;
+
+  static vec load(const char* ptr) { return _mm_loadu_si128(reinterpret_cast<const vec*>(ptr)); }
+  static vec eq(vec v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+  static vec or_(vec a, vec b) { return _mm_or_si128(a, b); }
+  static vec and_(vec a, vec b) { return _mm_and_si128(a, b); }
+  static std::uint64_t mask(vec v) { return static_cast<std::uint16_t>(_mm_movemask_epi8(v)); }
+};
+
+#elif defined(__ARM_NEON)
+#define PDF_SCAN_SIMD
+
+struct Simd {
+  using vec = uint8x16_t;
+  static constexpr std::size_t width = 16;
+  static constexpr unsigned shift = 2;
+
+  static vec load(const char* ptr) { return vld1q_u8(reinterpret_cast<const std::uint8_t*>(ptr)); }
+  static vec eq(vec v, char c) { return vceqq_u8(v, vdupq_n_u8(static_cast<std::uint8_t>(c))); }
+  static vec or_(vec a, vec b) { return vorrq_u8(a, b); }
+  static vec and_(vec a, vec b) { return vandq_u8(a, b); }
+  // NEON has no movemask, narrowing gives 4 bits per byte instead
+  static std::uint64_t mask(vec v) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+  }
+};
+
+#endif
+
+#ifdef PDF_SCAN_SIMD
+
+constexpr std::uint64_t fullMask = Simd::width << Simd::shift == 64
+  ? ~std::uint64_t{0} : (std::uint64_t{1} << (Simd::width << Simd::shift)) - 1;
+
+Simd::vec wsMask(Simd::vec v) {
+  return Simd::or_(
+      Simd::or_(Simd::or_(Simd::eq(v, ' '), Simd::eq(v, '\n')), Simd::or_(Simd::eq(v, '\r'), Simd::eq(v, '\t'))),
+      Simd::or_(Simd::eq(v, '\0'), Simd::eq(v, '\x0c')));
+}
+
+Simd::vec delimMask(Simd::vec v) {
+  return Simd::or_(
+      Simd::or_(
+        Simd::or_(Simd::or_(Simd::eq(v, '('), Simd::eq(v, ')')), Simd::or_(Simd::eq(v, '<'), Simd::eq(v, '>'))),
+        Simd::or_(Simd::or_(Simd::eq(v, '['), Simd::eq(v, ']')), Simd::or_(Simd::eq(v, '{'), Simd::eq(v, '}')))),
+      Simd::or_(Simd::eq(v, '/'), Simd::eq(v, '%')));
+}
+
+std::size_t firstBit(std::uint64_t mask) {
+  return static_cast<std::size_t>(__builtin_ctzll(mask)) >> Simd::shift;
+}
+
+/* Returns the first position where the bit mask computed by match is set,
+   or finishes by the scalar test if there's less than a block left. */
+template<typename Match, typename Scalar>
+const char* scan(const char* ptr, const char* end, Match match, Scalar scalar) {
+  for(; end - ptr >= static_cast<std::ptrdiff_t>(Simd::width); ptr += Simd::width)
+    if(std::uint64_t m = match(Simd::load(ptr)); m != 0)
+      return ptr + firstBit(m);
+  for(; ptr != end; ++ptr)
+    if(scalar(*ptr))
+      break;
+  return ptr;
+}
+
+#else
+
+template<typename Match, typename Scalar>
+const char* scan(const char* ptr, const char* end, Match, Scalar scalar) {
+  for(; ptr != end; ++ptr)
+    if(scalar(*ptr))
+      break;
+  return ptr;
+}
+
+#endif
+
+} // anonymous namespace
+
+namespace internal {
+
+const char* skipWS(const char* ptr, const char* end) {
+  return scan(ptr, end,
+#ifdef PDF_SCAN_SIMD
+      [](Simd::vec v) { return ~Simd::mask(wsMask(v)) & fullMask; },
+#else
+      nullptr,
+#endif
+      [](char c) { return charType(c) != CharType::ws; });
+}
+
+const char* skipRegular(const char* ptr, const char* end) {
+  return scan(ptr, end,
+#ifdef PDF_SCAN_SIMD
+      [](Simd::vec v) { return Simd::mask(Simd::or_(wsMask(v), delimMask(v))); },
+#else
+      nullptr,
+#endif
+      [](char c) { return charType(c) != CharType::regular; });
+}
+
+} // namespace pdf::parser::internal
+
+const char* findNL(const char* ptr, const char* end) {
+  return scan(ptr, end,
+#ifdef PDF_SCAN_SIMD
+      [](Simd::vec v) { return Simd::mask(Simd::or_(Simd::eq(v, '\n'), Simd::eq(v, '\r'))); },
+#else
+      nullptr,
+#endif
+      [](char c) { return c == '\n' || c == '\r'; });
+}
+
+const char* findKeyword(const char* ptr, const char* end, std::string_view keyword) {
+  const std::size_t len = keyword.length();
+  if(static_cast<std::size_t>(end - ptr) < len)
+    return end;
+  // Last position where keyword can start
+  const char* last = end - len;
+#ifdef PDF_SCAN_SIMD
+  // Candidates are where both the first and the last character match
+  const char cFirst = keyword.front();
+  const char cLast = keyword.back();
+  for(; last - ptr >= static_cast<std::ptrdiff_t>(Simd::width); ptr += Simd::width) {
+    std::uint64_t m = Simd::mask(Simd::and_(
+          Simd::eq(Simd::load(ptr), cFirst),
+          Simd::eq(Simd::load(ptr + len - 1), cLast)));
+    while(m != 0) {
+      std::size_t ix = firstBit(m);
+      if(std::memcmp(ptr + ix + 1, keyword.data() + 1, len - 1) == 0)
+        return ptr + ix;
+      // Clear all the mask bits belonging to this byte
+      m &= ~(((std::uint64_t{1} << (1 << Simd::shift)) - 1) << (ix << Simd::shift));
+    }
+  }
+#endif
+  for(; ptr <= last; ++ptr) {
+    ptr = static_cast<const char*>(std::memchr(ptr, keyword.front(), last - ptr + 1));
+    if(!ptr)
+      return end;
+    if(std::memcmp(ptr, keyword.data(), len) == 0)
+      return ptr;
+  }
+  return end;
+}
+
+const char* findKeywords(const char* ptr, const char* end,
+    const std::string_view* keywords, std::size_t count, std::size_t& which) {
+  auto matchAt = [&](const char* pos) {
+    for(std::size_t k = 0; k < count; k++)
+      if(*pos == keywords[k].front() && static_cast<std::size_t>(end - pos) >= keywords[k].length()
+          && std::memcmp(pos, keywords[k].data(), keywords[k].length()) == 0) {
+        which = k;
+        return true;
+      }
+    return false;
+  };
+#ifdef PDF_SCAN_SIMD
+  std::size_t maxLen = 0;
+  for(std::size_t k = 0; k < count; k++)
+    maxLen = std::max(maxLen, keywords[k].length());
+  // As in findKeyword, per keyword, but all combined in one mask
+  for(; end - ptr >= static_cast<std::ptrdiff_t>(Simd::width + maxLen - 1); ptr += Simd::width) {
+    Simd::vec v = Simd::load(ptr);
+    std::uint64_t m = 0;
+    for(std::size_t k = 0; k < count; k++)
+      m |= Simd::mask(Simd::and_(
+            Simd::eq(v, keywords[k].front()),
+            Simd::eq(Simd::load(ptr + keywords[k].length() - 1), keywords[k].back())));
+    while(m != 0) {
+      std::size_t ix = firstBit(m);
+      if(matchAt(ptr + ix))
+        return ptr + ix;
+      m &= ~(((std::uint64_t{1} << (1 << Simd::shift)) - 1) << (ix << Simd::shift));
+    }
+  }
+#endif
+  for(; ptr != end; ++ptr)
+    if(matchAt(ptr))
+      return ptr;
+  return end;
+}
+
+} // namespace pdf::parser
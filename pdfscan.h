@@ -0,0 +1,70 @@
+#ifndef PDF_SCAN_H
+#define PDF_SCAN_H
+
+#include <array>
+#include <string_view>
+
+namespace pdf::parser {
+
+enum class CharType {
+  ws,
+  delim,
+  regular
+};
+
+namespace internal {
+
+inline constexpr std::array<CharType, 256> charTypes = [] {
+  std::array<CharType, 256> table{};
+  for(auto& t : table)
+    t = CharType::regular;
+  for(unsigned char c : std::string_view{"\0\t\r\n\x0c ", 6})
+    table[c] = CharType::ws;
+  for(unsigned char c : std::string_view{"()<>[]{}/%"})
+    table[c] = CharType::delim;
+  return table;
+}();
+
+const char* skipWS(const char* ptr, const char* end);
+const char* skipRegular(const char* ptr, const char* end);
+
+} // namespace pdf::parser::internal
+
+inline CharType charType(char c) {
+  return internal::charTypes[static_cast<unsigned char>(c)];
+}
+
+/* Block scanners over contiguous memory. They use SSE2, AVX2 or NEON
+   when the compiler targets them, and a table lookup otherwise. All return
+   end if nothing is found. */
+
+// First character that is not whitespace
+inline const char* skipWS(const char* ptr, const char* end) {
+  // Most runs of whitespace are a single character
+  if(ptr != end && charType(*ptr) != CharType::ws)
+    return ptr;
+  return internal::skipWS(ptr, end);
+}
+
+// First character that is not regular, i.e., the end of a regular token
+inline const char* skipRegular(const char* ptr, const char* end) {
+  if(ptr != end && charType(*ptr) != CharType::regular)
+    return ptr;
+  return internal::skipRegular(ptr, end);
+}
+
+// First '\r' or '\n'
+const char* findNL(const char* ptr, const char* end);
+
+// First occurrence of keyword (which must be nonempty)
+const char* findKeyword(const char* ptr, const char* end, std::string_view keyword);
+
+/* First occurrence of any of count keywords (all nonempty) in a single pass.
+   Its index is stored in which. If several match at the same place, the
+   first one listed wins. */
+const char* findKeywords(const char* ptr, const char* end,
+    const std::string_view* keywords, std::size_t count, std::size_t& which);
+
+} // namespace pdf::parser
+
+#endif
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <istream>
+#include <memory>
+
+#include "pdfsplit.h"
+#include "pdfparser.h"
+#include "pdfscan.h"
+
+namespace pdf::parser {
+
+namespace {
+
+bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Skips backwards over a nonempty run of chars satisfying pred, returns npos if empty.
+template<typename Pred>
+std::size_t skipBack(std::string_view data, std::size_t pos, Pred pred) {
+  std::size_t start = pos;
+  while(start > 0 && pred(data[start - 1]))
+    --start;
+  return start == pos ? std::string_view::npos : start;
+}
+
+} // anonymous namespace
+
+std::size_t findObjHeader(std::string_view data, std::size_t from) {
+  const std::string_view keyword = "obj";
+  const char* end = data.data() + data.length();
+  auto ws = [](char c) { return charType(c) == CharType::ws; };
+  for(const char* ptr = findKeyword(data.data() + std::min(from, data.length()), end, keyword);
+      ptr != end; ptr = findKeyword(ptr + 1, end, keyword)) {
+    if(const char* after = ptr + keyword.length(); after != end && charType(*after) == CharType::regular)
+      continue;
+    // Match backwards: ws gen ws num, preceded by ws or start of input
+    std::size_t pos = ptr - data.data();
+    if((pos = skipBack(data, pos, ws)) == std::string_view::npos
+        || (pos = skipBack(data, pos, isDigit)) == std::string_view::npos
+        || (pos = skipBack(data, pos, ws)) == std::string_view::npos
+        || (pos = skipBack(data, pos, isDigit)) == std::string_view::npos)
+      continue;
+    if(pos < from)
+      continue;
+    if(pos == 0 || ws(data[pos - 1]))
+      return pos;
+  }
+  return data.length();
+}
+
+std::vector<ParsedObject> parseRange(const InputBuffer& input, std::streamoff from, std::streamoff stop) {
+  std::vector<ParsedObject> ret{};
+  // Every range needs its own cursor
+  InputBuffer buf{input.data(), input.owner()};
+  buf.seek(buf.begin() + from);
+  std::istream is{&buf};
+  while(true) {
+    std::streamoff start = buf.offset(buf.cur());
+    if(start >= stop)
+      break;
+    TopLevelObject tlo{};
+    is >> tlo;
+    if(is.eof())
+      break;
+    is.clear();
+    if(tlo.is<Invalid>()) {
+      bool recovered = static_cast<bool>(is >> skipToEndObj);
+      is.clear();
+      ret.push_back({start, buf.offset(buf.cur()), std::move(tlo), recovered});
+      if(!recovered)
+        break;
+    } else
+      ret.push_back({start, buf.offset(buf.cur()), std::move(tlo), true});
+  }
+  return ret;
+}
+
+void parseSplit(const InputBuffer& input, std::streamoff from, WorkerPool& pool,
+    std::size_t chunkSize, const std::function<void(ParsedObject&&)>& callback) {
+  const std::string_view data = input.data();
+  const std::streamoff size = data.length();
+  chunkSize = std::max<std::size_t>(chunkSize, 1);
+  using Result = std::vector<ParsedObject>;
+
+  // Chunk k covers [chunkStart(k), chunkStart(k + 1)) before aligning to headers
+  auto chunkStart = [from, size, chunkSize](std::size_t k) {
+    return std::min<std::streamoff>(size, from + static_cast<std::streamoff>(k * chunkSize));
+  };
+  auto submit = [&](std::size_t k) {
+    auto promise = std::make_shared<std::promise<Result>>();
+    auto future = promise->get_future();
+    pool.submit([&input, data, promise, k, from, size, chunkStart] {
+      try {
+        std::streamoff start = k == 0 ? from : findObjHeader(data, chunkStart(k));
+        std::streamoff next = chunkStart(k + 1);
+        std::streamoff stop = next >= size ? size : findObjHeader(data, next);
+        promise->set_value(start < stop ? parseRange(input, start, stop) : Result{});
+      } catch(...) {
+        promise->set_exception(std::current_exception());
+      }
+    });
+    return future;
+  };
+
+  const std::size_t chunks = (size - std::min(from, size) + chunkSize - 1) / chunkSize;
+  const std::size_t ahead = std::max<std::size_t>(2 * pool.threads(), 1);
+  std::deque<std::future<Result>> pending{};
+  std::size_t submitted = 0;
+  for(; submitted < std::min(ahead, chunks); submitted++)
+    pending.push_back(submit(submitted));
+
+  // The position where sequential reading would continue
+  std::streamoff pos = from;
+  auto emit = [&pos, &callback](ParsedObject&& po) {
+    pos = po.end;
+    callback(std::move(po));
+  };
+  while(!pending.empty()) {
+    Result range = pending.front().get();
+    pending.pop_front();
+    if(submitted < chunks)
+      pending.push_back(submit(submitted++));
+    auto it = range.begin();
+    while(it != range.end()) {
+      // In sync if reading in this range started or continued at pos
+      if(it->start == pos)
+        break;
+      it = std::find_if(it, range.end(), [pos](const auto& po) { return po.end >= pos; });
+      if(it == range.end())
+        break;
+      if(it->end == pos) {
+        ++it;
+        break;
+      }
+      // Out of sync: read on sequentially, one object at a time
+      Result one = parseRange(input, pos, pos + 1);
+      if(one.empty()) {
+        pos = size;
+        break;
+      }
+      emit(std::move(one.front()));
+    }
+    for(; it != range.end(); ++it)
+      emit(std::move(*it));
+  }
+  // Whatever follows the last object
+  if(pos < size)
+    for(auto& po : parseRange(input, pos, size))
+      emit(std::move(po));
+}
+
+} // namespace pdf::parser
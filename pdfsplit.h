@@ -0,0 +1,42 @@
+#ifndef PDF_SPLIT_H
+#define PDF_SPLIT_H
+
+#include <functional>
+#include <string_view>
+#include <vector>
+
+#include "pdfbase.h"
+#include "pdffile.h"
+#include "pdfinput.h"
+#include "pdfpool.h"
+
+namespace pdf::parser {
+
+// A top-level object together with where reading it started and ended.
+struct ParsedObject {
+  std::streamoff start;
+  std::streamoff end;  // If tlo is Invalid, after skipping to the next endobj
+  TopLevelObject tlo;
+  bool recovered;      // If tlo is Invalid: false if no endobj followed
+};
+
+/* Position of the first "num gen obj" header at or after from, or the
+   length of data if there is none. This may match inside stream data. */
+std::size_t findObjHeader(std::string_view data, std::size_t from);
+
+/* Reads top-level objects like a loop of operator>> with skipToEndObj for
+   recovery would, starting at from, until the reading position reaches
+   stop or the end of input. */
+std::vector<ParsedObject> parseRange(const InputBuffer& input, std::streamoff from, std::streamoff stop);
+
+/* Reads all top-level objects from from to the end of input. The input is
+   split into chunks at object headers, which are parsed concurrently in
+   the pool. Chunks that were split at false boundaries are resynchronized,
+   so the callback receives exactly the same objects in the same order as
+   from a single parseRange(input, from, end). */
+void parseSplit(const InputBuffer& input, std::streamoff from, WorkerPool& pool,
+    std::size_t chunkSize, const std::function<void(ParsedObject&&)>& callback);
+
+} // namespace pdf::parser
+
+#endif
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <iterator>
+
+#include "pdfstats.h"
+
+#ifdef PDF_STATS
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#endif
+
+namespace pdf::stats {
+
+namespace {
+
+constexpr const char* counterNames[] = {
+  "tokens",
+  "token_bytes",
+  "allocations",
+  "allocated_bytes",
+  "streams_referenced",
+  "stream_bytes_referenced",
+  "streams_copied",
+  "stream_bytes_copied",
+  "inflate_in",
+  "inflate_out",
+  "output_files",
+  "output_bytes",
+  "named_objects",
+  "xref_tables",
+  "trailers",
+  "startxrefs",
+  "invalid_top_level",
+  "nulls",
+  "booleans",
+  "numerics",
+  "strings",
+  "names",
+  "arrays",
+  "dictionaries",
+  "streams",
+  "indirects",
+  "invalid_contents"
+};
+static_assert(std::size(counterNames) == static_cast<std::size_t>(Counter::count_));
+
+constexpr const char* timerNames[] = {
+  "parse",
+  "parse_stream",
+  "inflate",
+  "output"
+};
+static_assert(std::size(timerNames) == static_cast<std::size_t>(Timer::count_));
+
+#ifdef PDF_STATS
+
+/* Blocks of running threads form a list, finished ones are added up in
+   retired. Nothing here allocates, operator new relies on that. */
+std::mutex mutex;
+internal::Block* first = nullptr;
+std::uint64_t retiredCounts[internal::counters];
+std::uint64_t retiredNanos[internal::timers];
+
+#endif
+
+} // anonymous namespace
+
+#ifdef PDF_STATS
+
+internal::Block::Block() : counts{}, nanos{}, prev{nullptr}, next{nullptr} {
+  std::lock_guard lock{mutex};
+  next = first;
+  if(first)
+    first->prev = this;
+  first = this;
+}
+
+internal::Block::~Block() {
+  std::lock_guard lock{mutex};
+  for(std::size_t i = 0; i < counters; i++)
+    retiredCounts[i] += counts[i].load(std::memory_order_relaxed);
+  for(std::size_t i = 0; i < timers; i++)
+    retiredNanos[i] += nanos[i].load(std::memory_order_relaxed);
+  (prev ? prev->next : first) = next;
+  if(next)
+    next->prev = prev;
+}
+
+std::string json() {
+  std::uint64_t counts[internal::counters];
+  std::uint64_t nanos[internal::timers];
+  {
+    std::lock_guard lock{mutex};
+    std::copy(std::begin(retiredCounts), std::end(retiredCounts), counts);
+    std::copy(std::begin(retiredNanos), std::end(retiredNanos), nanos);
+    for(const internal::Block* b = first; b; b = b->next) {
+      for(std::size_t i = 0; i < internal::counters; i++)
+        counts[i] += b->counts[i].load(std::memory_order_relaxed);
+      for(std::size_t i = 0; i < internal::timers; i++)
+        nanos[i] += b->nanos[i].load(std::memory_order_relaxed);
+    }
+  }
+  std::string ret = "{\n  \"counters\": {";
+  for(std::size_t i = 0; i < internal::counters; i++)
+    ret += std::string{i ? ",\n" : "\n"} + "    \"" + counterNames[i] + "\": " + std::to_string(counts[i]);
+  ret += "\n  },\n  \"timers_ns\": {";
+  for(std::size_t i = 0; i < internal::timers; i++)
+    ret += std::string{i ? ",\n" : "\n"} + "    \"" + timerNames[i] + "\": " + std::to_string(nanos[i]);
+  ret += "\n  }\n}\n";
+  return ret;
+}
+
+#else
+
+std::string json() {
+  return {};
+}
+
+#endif
+
+} // namespace pdf::stats
+
+#ifdef PDF_STATS
+
+/***** Counting allocations *****/
+
+void* operator new(std::size_t size) {
+  pdf::stats::add(pdf::stats::Counter::allocations);
+  pdf::stats::add(pdf::stats::Counter::allocatedBytes, size);
+  if(void* ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+#endif
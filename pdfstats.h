@@ -0,0 +1,133 @@
+#ifndef PDF_STATS_H
+#define PDF_STATS_H
+
+#include <cstdint>
+#include <string>
+
+#ifdef PDF_STATS
+#include <array>
+#include <atomic>
+#include <chrono>
+#endif
+
+namespace pdf::stats {
+
+/* Counters and timers on the hot paths, compiled in only with PDF_STATS
+   (make STATS=1). Without it, add() and ScopedTimer are empty and vanish
+   from the code. Each thread counts in its own block, so a count is a
+   plain addition; json() sums over all threads, including finished ones.
+   Allocations are counted by replacing the global operator new. */
+enum class Counter {
+  tokens,
+  tokenBytes,       // text of the tokens, strings and stream data aside
+  allocations,
+  allocatedBytes,
+  streamsReferenced, // stream data left in the input
+  streamBytesReferenced,
+  streamsCopied,
+  streamBytesCopied,
+  inflateIn,
+  inflateOut,
+  outputFiles,
+  outputBytes,
+  // Top-level objects
+  namedObjects,
+  xrefTables,
+  trailers,
+  startXRefs,
+  invalidTopLevel,
+  // Contents of named objects
+  nulls,
+  booleans,
+  numerics,
+  strings,
+  names,
+  arrays,
+  dictionaries,
+  streams,
+  indirects,
+  invalidContents,
+  count_
+};
+
+// Time spent, summed over threads. parse includes parseStream.
+enum class Timer {
+  parse,
+  parseStream,
+  inflate,
+  output,
+  count_
+};
+
+constexpr bool enabled() {
+#ifdef PDF_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+// All counters and timers as a JSON object.
+std::string json();
+
+#ifdef PDF_STATS
+
+namespace internal {
+
+constexpr std::size_t counters = static_cast<std::size_t>(Counter::count_);
+constexpr std::size_t timers = static_cast<std::size_t>(Timer::count_);
+
+// Written only by its thread, relaxed atomics let json() read them.
+struct Block {
+  std::array<std::atomic<std::uint64_t>, counters> counts;
+  std::array<std::atomic<std::uint64_t>, timers> nanos;
+  Block* prev;
+  Block* next;
+
+  Block();
+  ~Block();
+};
+
+inline thread_local Block block{};
+
+inline void bump(std::atomic<std::uint64_t>& val, std::uint64_t n) {
+  val.store(val.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+} // namespace internal
+
+inline void add(Counter counter, std::uint64_t n = 1) {
+  internal::bump(internal::block.counts[static_cast<std::size_t>(counter)], n);
+}
+
+class ScopedTimer {
+  Timer _timer;
+  std::chrono::steady_clock::time_point _start;
+
+  public:
+  ScopedTimer(Timer timer) : _timer{timer}, _start{std::chrono::steady_clock::now()} { }
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  ~ScopedTimer() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start);
+    internal::bump(internal::block.nanos[static_cast<std::size_t>(_timer)], ns.count());
+  }
+};
+
+#else
+
+inline void add(Counter, std::uint64_t = 1) { }
+
+class ScopedTimer {
+  public:
+  ScopedTimer(Timer) { }
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+#endif
+
+} // namespace pdf::stats
+
+#endif